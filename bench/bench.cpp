@@ -0,0 +1,480 @@
+﻿#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <iterator>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#if defined(__x86_64__) || defined(_M_X64)
+    #define _LZIP_RDTSC 1
+    #if defined(_MSC_VER)
+        #include <intrin.h> // IWYU pragma: keep
+    #else
+        #include <x86intrin.h> // IWYU pragma: keep
+    #endif
+#endif
+
+#include "compress.hpp"
+#include "decompress.hpp"
+#include "huffman.hpp"
+#include "lzip.hpp"
+#include "preset.hpp"
+
+//Benchmarks the coding stages on in-memory corpora, so numbers don't depend on the disk
+//  lzip_bench [options]: runs every stage on every corpus and prints one JSON result per line
+//  lzip_bench --compare <base.json> <new.json>: lines up two runs and exits with 1 if any stage got slower or bigger beyond the tolerance
+namespace Lzip::Bench {
+    typedef uint8_t u8;
+    typedef uint16_t u16;
+    typedef uint32_t u32;
+    typedef uint64_t u64;
+    using std::array, std::cout, std::cerr, std::string, std::vector, std::span, std::chrono::steady_clock;
+
+    //Bumped whenever the fields or their meaning change, results of different versions aren't compared
+    inline constexpr u32 RESULT_VERSION = 1;
+    //Bytes between flushes for the "flushN" stages, from a few log records up to well short of a block
+    inline constexpr array<u64, 3> FLUSH_INTERVALS{512, 8192, 131072};
+
+    struct Options {
+        u64 corpusSize{16ull << 20};
+        u32 repeats{5};
+        CompressOptions compress;
+        //Empty means all synthetic corpora
+        vector<string> corpora;
+        vector<string> files;
+        string output;
+    };
+
+    struct Corpus {
+        string name;
+        vector<u8> data;
+    };
+
+    struct Result {
+        string corpus, stage;
+        u64 bytes{0}, blocks{0}, outputBytes{0};
+        double seconds{0}, cycles{0};
+    };
+
+    //splitmix64: the same bytes on every platform and standard library, unlike `std::` distributions
+    struct Random {
+        u64 state;
+        [[nodiscard]] u64 next() noexcept {
+            u64 z = (state += 0x9E3779B97F4A7C15ull);
+            z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+            z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+            return z ^ (z >> 31);
+        }
+        //Low values much more often than high ones, roughly Zipf-like
+        [[nodiscard]] u32 skewed(u32 bound) noexcept {
+            const u64 value = next();
+            return static_cast<u32>(((value & 0xFFFFFFFF) % bound) * ((value >> 32) % bound) / bound);
+        }
+    };
+
+    [[nodiscard]] inline vector<u8> generateRandom(u64 size, Random& random) {
+        vector<u8> data(size);
+        for (u64 i = 0; i < size; i += 8) {
+            const u64 value = random.next();
+            std::memcpy(data.data() + i, &value, std::min<u64>(8, size - i));
+        }
+        return data;
+    }
+
+    [[nodiscard]] inline vector<u8> generateSkewed(u64 size, Random& random) {
+        vector<u8> data(size);
+        for (u8& byte : data) byte = static_cast<u8>(random.skewed(256));
+        return data;
+    }
+
+    [[nodiscard]] inline vector<u8> generateText(u64 size, Random& random) {
+        static constexpr array<const char*, 32> WORDS{"the", "of", "and", "to", "in", "a", "is", "that", "for", "it", "as", "was", "with", "be", "by", "on", "not", "he", "this", "are", "or", "his", "from", "at", "which", "but", "have", "an", "had", "they", "you", "were"};
+        vector<u8> data;
+        data.reserve(size + 16);
+        u32 wordsInSentence = 0;
+        while (data.size() < size) {
+            const char* word = WORDS[random.skewed(WORDS.size())];
+            data.insert(data.end(), word, word + std::strlen(word));
+            if (++wordsInSentence > 4 + random.next() % 12) {
+                data.push_back('.');
+                data.push_back(random.next() % 6 == 0 ? '\n' : ' ');
+                wordsInSentence = 0;
+            }
+            else data.push_back(' ');
+        }
+        data.resize(size);
+        return data;
+    }
+
+    [[nodiscard]] inline vector<u8> generateRecords(u64 size, Random& random) {
+        static constexpr array<const char*, 6> NAMES{"alpha", "beta", "gamma", "delta", "epsilon", "zeta"};
+        vector<u8> data;
+        data.reserve(size + 64);
+        string row;
+        for (u64 id = 0; data.size() < size; id++) {
+            std::ostringstream line;
+            line << std::setw(8) << std::setfill('0') << id << ',' << NAMES[random.skewed(NAMES.size())] << ',' << random.next() % 10000 << '.' << std::setw(2) << random.next() % 100 << ",20" << std::setw(2) << random.next() % 25 << '-' << std::setw(2) << 1 + random.next() % 12 << '\n';
+            row = line.str();
+            data.insert(data.end(), row.begin(), row.end());
+        }
+        data.resize(size);
+        return data;
+    }
+
+    [[nodiscard]] inline bool loadCorpora(const Options& options, vector<Corpus>& corpora) {
+        struct Generator {
+            const char* name;
+            vector<u8> (*generate)(u64, Random&);
+        };
+        const array<Generator, 5> generators{{
+            {"random", generateRandom},
+            {"skewed", generateSkewed},
+            {"text", generateText},
+            {"records", generateRecords},
+            {"constant", [](u64 size, Random&) { return vector<u8>(size, 'A'); }},
+        }};
+        for (u32 i = 0; i < generators.size(); i++) {
+            const Generator& generator = generators[i];
+            if (!options.corpora.empty() && std::find(options.corpora.begin(), options.corpora.end(), generator.name) == options.corpora.end()) continue;
+            //Every corpus has its own fixed seed, so selecting a subset doesn't change the others
+            Random random{i + 1};
+            corpora.push_back({generator.name, generator.generate(options.corpusSize, random)});
+        }
+        for (const string& file : options.files) {
+            std::ifstream stream(file, std::ios::binary);
+            if (!stream) {
+                cerr << "无法打开语料文件：" << file << '\n';
+                return false;
+            }
+            corpora.push_back({"file:" + file, vector<u8>(std::istreambuf_iterator<char>(stream), {})});
+        }
+        return true;
+    }
+
+    //Time stamp counter ticks, which track the nominal clock rather than the core's current one; 0 where there is no such counter
+    [[nodiscard]] inline u64 readCycles() noexcept {
+        #if _LZIP_RDTSC
+            return __rdtsc();
+        #else
+            return 0;
+        #endif
+    }
+
+    //Runs `body` `repeats` times and keeps the fastest, the one least disturbed by the rest of the system
+    template <typename Body>
+    inline void measure(u32 repeats, Result& result, Body&& body) {
+        result.seconds = 1e300;
+        for (u32 i = 0; i < repeats; i++) {
+            const u64 startCycles = readCycles();
+            const steady_clock::time_point start = steady_clock::now();
+            body();
+            const double seconds = std::chrono::duration<double>(steady_clock::now() - start).count();
+            if (seconds < result.seconds) {
+                result.seconds = seconds;
+                result.cycles = static_cast<double>(readCycles() - startCycles);
+            }
+        }
+    }
+
+    [[nodiscard]] inline vector<span<const u8>> splitBlocks(const vector<u8>& data, u64 blockSize) {
+        vector<span<const u8>> blocks;
+        for (u64 offset = 0; offset < data.size(); offset += blockSize) blocks.push_back(span<const u8>(data).subspan(offset, std::min(blockSize, data.size() - offset)));
+        return blocks;
+    }
+
+    //Stages: "histogram" counts bytes, "table" builds a Huffman code per block from them, "compress" and "decompress" code whole blocks as the CLI would
+    //"encodeN" and "decodeN" call the byte coding kernels for codes of up to N bits directly, with each block's code limited to N bits, so every specialization is measured whichever one the blocks would pick
+    //"flushN" streams the corpus through an `Encoder` flushing every N bytes and a `Decoder` fed each frame as it comes, "blocks" is then the frame count and "usPerBlock" the latency a frame adds
+    //"flushN-text" and "flushN-json" do the same with a built-in preset table, which spares short frames the histogram and the table
+    [[nodiscard]] inline bool runCorpus(const Corpus& corpus, const Options& options, vector<Result>& results) {
+        const vector<span<const u8>> blocks = splitBlocks(corpus.data, options.compress.blockSize);
+        const auto makeResult = [&](const char* stage) {
+            Result result;
+            result.corpus = corpus.name;
+            result.stage = stage;
+            result.bytes = corpus.data.size();
+            result.blocks = blocks.size();
+            return result;
+        };
+        vector<array<u64, 256>> frequencies(blocks.size());
+        Result histogram = makeResult("histogram");
+        measure(options.repeats, histogram, [&]() {
+            for (u64 i = 0; i < blocks.size(); i++) {
+                frequencies[i].fill(0);
+                if (options.compress.sampledHistogram) Huffman::updateFrequencySampled(blocks[i], frequencies[i]);
+                else Huffman::updateFrequency(blocks[i], frequencies[i]);
+            }
+        });
+        results.push_back(histogram);
+        Result table = makeResult("table");
+        array<Huffman::HuffmanCode, 256> codes;
+        measure(options.repeats, table, [&]() {
+            for (const array<u64, 256>& blockFrequencies : frequencies) {
+                u16 presentedSymbolCount;
+                Huffman::getHuffmanCode(blockFrequencies, codes, presentedSymbolCount);
+            }
+        });
+        results.push_back(table);
+        vector<vector<u8>> compressed(blocks.size());
+        Result compress = makeResult("compress");
+        measure(options.repeats, compress, [&]() {
+            for (u64 i = 0; i < blocks.size(); i++) {
+                compressed[i].clear();
+                compressBlock(blocks[i], compressed[i], options.compress);
+            }
+        });
+        for (const vector<u8>& block : compressed) compress.outputBytes += block.size();
+        results.push_back(compress);
+        //Whatever the options, a sampled histogram included, a block of one repeated byte has to come out as RLE
+        for (u64 i = 0; i < blocks.size(); i++) {
+            const bool singleByte = std::all_of(blocks[i].begin(), blocks[i].end(), [first = blocks[i][0]](u8 byte) { return byte == first; });
+            if (singleByte && Container::readBlockHeader(compressed[i].data()).type != Container::BlockType::Rle) {
+                cerr << "单一字节的区块没有编码为 RLE：" << corpus.name << '\n';
+                return false;
+            }
+        }
+        vector<u8> decompressed(corpus.data.size());
+        Result decompress = makeResult("decompress");
+        bool decoded = true;
+        measure(options.repeats, decompress, [&]() {
+            u64 offset = 0;
+            for (u64 i = 0; i < blocks.size(); i++) {
+                decoded &= decompressBlock(compressed[i], span<u8>(decompressed).subspan(offset, blocks[i].size()));
+                offset += blocks[i].size();
+            }
+        });
+        decompress.outputBytes = compress.outputBytes;
+        results.push_back(decompress);
+        if (!decoded || decompressed != corpus.data) {
+            cerr << "往返校验失败：" << corpus.name << '\n';
+            return false;
+        }
+        vector<PackedCodes> packedCodes(blocks.size());
+        vector<Huffman::DecodeTable> decodeTables(blocks.size());
+        for (u32 kernel = 0; kernel < Huffman::KERNEL_COUNT; kernel++) {
+            const u16 maxCodeLen = Huffman::KERNEL_CODE_LENS[kernel];
+            for (u64 i = 0; i < blocks.size(); i++) {
+                u16 presentedSymbolCount;
+                Huffman::getHuffmanCode(frequencies[i], codes, presentedSymbolCount, maxCodeLen);
+                for (u32 byte = 0; byte < 256; byte++) packedCodes[i][byte] = static_cast<u32>(codes[byte].code << 5) | codes[byte].codeLen;
+                if (!Huffman::buildDecodeTable(codes, decodeTables[i])) return false;
+                compressed[i].resize(((blocks[i].size() * maxCodeLen) >> 3) + 16);
+            }
+            Result encode = makeResult(("encode" + std::to_string(maxCodeLen)).c_str());
+            measure(options.repeats, encode, [&]() {
+                encode.outputBytes = 0;
+                for (u64 i = 0; i < blocks.size(); i++) {
+                    u8* out = compressed[i].data();
+                    EncoderState state;
+                    ENCODE_KERNELS[kernel](blocks[i], packedCodes[i], out, state);
+                    if (state.bitCount > 0) *out++ = static_cast<u8>(state.bitBuffer >> 56);
+                    encode.outputBytes += static_cast<u64>(out - compressed[i].data());
+                }
+            });
+            results.push_back(encode);
+            Result decode = makeResult(("decode" + std::to_string(maxCodeLen)).c_str());
+            measure(options.repeats, decode, [&]() {
+                u64 offset = 0;
+                for (u64 i = 0; i < blocks.size(); i++) {
+                    u64 position = 0;
+                    DecoderState state;
+                    decoded &= DECODE_KERNELS[kernel](compressed[i], position, decodeTables[i], state, decompressed.data() + offset, blocks[i].size()) == blocks[i].size();
+                    offset += blocks[i].size();
+                }
+            });
+            decode.outputBytes = encode.outputBytes;
+            results.push_back(decode);
+            if (!decoded || decompressed != corpus.data) {
+                cerr << "往返校验失败：" << corpus.name << " " << encode.stage << '\n';
+                return false;
+            }
+        }
+        Decoder decoder;
+        vector<u8> frame, received;
+        const span<const u8> data(corpus.data);
+        for (u64 preset = 0; preset <= Preset::BUILTIN_TABLES.size(); preset++) for (const u64 interval : FLUSH_INTERVALS) {
+            CompressOptions framedOptions = options.compress;
+            framedOptions.preset = preset == 0 ? 0 : Preset::BUILTIN_TABLES[preset - 1].id;
+            Encoder encoder(framedOptions);
+            Result framed = makeResult(("flush" + std::to_string(interval) + (preset == 0 ? "" : string("-") + Preset::BUILTIN_TABLES[preset - 1].name)).c_str());
+            framed.blocks = (data.size() + interval - 1) / interval;
+            bool streamed = true;
+            measure(options.repeats, framed, [&]() {
+                framed.outputBytes = 0;
+                received.clear();
+                for (u64 offset = 0; offset < data.size(); offset += interval) {
+                    frame.clear();
+                    encoder.update(data.subspan(offset, std::min(interval, data.size() - offset)), frame);
+                    encoder.flush(frame);
+                    framed.outputBytes += frame.size();
+                    streamed &= decoder.update(frame, received) == Status::Ok;
+                }
+                frame.clear();
+                encoder.finish(frame);
+                framed.outputBytes += frame.size();
+                streamed &= decoder.update(frame, received) == Status::Ok && decoder.finish() == Status::Ok;
+            });
+            results.push_back(framed);
+            if (!streamed || received != corpus.data) {
+                cerr << "往返校验失败：" << corpus.name << " " << framed.stage << '\n';
+                return false;
+            }
+        }
+        return true;
+    }
+
+    [[nodiscard]] inline double megabytesPerSecond(const Result& result) noexcept {
+        return result.seconds > 0 ? static_cast<double>(result.bytes) / result.seconds / 1e6 : 0;
+    }
+
+    //Each result on a line of its own, which keeps files diffable and `--compare` trivial to parse
+    inline void writeResults(std::ostream& out, const Options& options, const vector<Result>& results) {
+        out << "{\"version\":" << RESULT_VERSION << ",\"blockSize\":" << options.compress.blockSize << ",\"level\":" << options.compress.level << ",\"corpusSize\":" << options.corpusSize << ",\"repeats\":" << options.repeats
+            << ",\"sampled\":" << (options.compress.sampledHistogram ? "true" : "false") << ",\"interleaved\":" << (options.compress.interleaved ? "true" : "false") << ",\"context\":" << (options.compress.contextModel ? "true" : "false") << ",\"results\":[\n";
+        for (u64 i = 0; i < results.size(); i++) {
+            const Result& result = results[i];
+            //Per block is the number that matters for the table stage, whose cost doesn't grow with the bytes
+            out << std::fixed << std::setprecision(9) << "{\"corpus\":\"" << result.corpus << "\",\"stage\":\"" << result.stage << "\",\"bytes\":" << result.bytes << ",\"blocks\":" << result.blocks << ",\"seconds\":" << result.seconds
+                << std::setprecision(3) << ",\"usPerBlock\":" << result.seconds * 1e6 / static_cast<double>(result.blocks) << std::setprecision(2) << ",\"mbps\":" << megabytesPerSecond(result) << ",\"cyclesPerByte\":";
+            if (result.cycles > 0) out << std::setprecision(3) << result.cycles / static_cast<double>(result.bytes);
+            else out << "null";
+            if (result.outputBytes > 0) out << std::setprecision(6) << ",\"ratio\":" << static_cast<double>(result.outputBytes) / static_cast<double>(result.bytes);
+            out << '}' << (i + 1 < results.size() ? ",\n" : "\n");
+        }
+        out << "]}\n";
+    }
+
+    //Reads back what `writeResults` wrote, keyed by corpus and stage
+    [[nodiscard]] inline bool readResults(const string& file, std::map<std::pair<string, string>, Result>& results) {
+        std::ifstream stream(file);
+        if (!stream) {
+            cerr << "无法打开结果文件：" << file << '\n';
+            return false;
+        }
+        const auto field = [](const string& line, const string& name) -> string {
+            const u64 start = line.find("\"" + name + "\":");
+            if (start == string::npos) return "";
+            u64 begin = start + name.size() + 3, end = begin;
+            if (line[begin] == '"') end = line.find('"', ++begin);
+            else end = line.find_first_of(",}", begin);
+            return line.substr(begin, end - begin);
+        };
+        string line;
+        u32 version = 0;
+        while (std::getline(stream, line)) {
+            if (line.starts_with("{\"version\":")) version = static_cast<u32>(std::stoul(field(line, "version")));
+            if (!line.starts_with("{\"corpus\":")) continue;
+            Result result;
+            result.corpus = field(line, "corpus");
+            result.stage = field(line, "stage");
+            result.bytes = std::stoull(field(line, "bytes"));
+            result.seconds = std::stod(field(line, "seconds"));
+            const string ratio = field(line, "ratio");
+            if (!ratio.empty()) result.outputBytes = static_cast<u64>(std::stod(ratio) * static_cast<double>(result.bytes) + 0.5);
+            results[{result.corpus, result.stage}] = result;
+        }
+        if (version != RESULT_VERSION) {
+            cerr << "结果文件版本不匹配：" << file << '\n';
+            return false;
+        }
+        return true;
+    }
+
+    //A stage regresses when it got more than `tolerance` percent slower, or its output grew by more than 0.1%
+    [[nodiscard]] inline int compareResults(const string& baseFile, const string& newFile, double tolerance) {
+        std::map<std::pair<string, string>, Result> baseResults, newResults;
+        if (!readResults(baseFile, baseResults) || !readResults(newFile, newResults)) return 2;
+        u32 regressions = 0;
+        cout << std::left << std::setw(24) << "corpus" << std::setw(12) << "stage" << std::right << std::setw(12) << "base MB/s" << std::setw(12) << "new MB/s" << std::setw(10) << "speed" << std::setw(10) << "size" << '\n';
+        for (const auto& [key, newResult] : newResults) {
+            const auto base = baseResults.find(key);
+            if (base == baseResults.end()) continue;
+            const double baseSpeed = megabytesPerSecond(base->second), newSpeed = megabytesPerSecond(newResult);
+            const double speedChange = baseSpeed > 0 ? (newSpeed / baseSpeed - 1) * 100 : 0;
+            const double sizeChange = base->second.outputBytes > 0 ? (static_cast<double>(newResult.outputBytes) / static_cast<double>(base->second.outputBytes) - 1) * 100 : 0;
+            const bool regressed = speedChange < -tolerance || sizeChange > 0.1;
+            regressions += regressed;
+            cout << std::left << std::setw(24) << key.first << std::setw(12) << key.second << std::right << std::fixed << std::setprecision(1) << std::setw(12) << baseSpeed << std::setw(12) << newSpeed
+                 << std::showpos << std::setw(9) << speedChange << '%' << std::setprecision(2) << std::setw(9) << sizeChange << '%' << std::noshowpos << (regressed ? "  REGRESSION" : "") << '\n';
+        }
+        cout << regressions << " 项退化（速度容差 " << tolerance << "%）\n";
+        return regressions > 0 ? 1 : 0;
+    }
+
+    inline void printUsage() {
+        cout << "用法：lzip_bench [选项]\n"
+                "      lzip_bench --compare <基准.json> <新.json> [--tolerance 百分比]\n"
+                "  --corpus <名称>      只测指定语料，可重复：random skewed text records constant\n"
+                "  --file <路径>        回放真实文件作为语料，可重复\n"
+                "  --size <MiB>         每个合成语料的大小，默认 16\n"
+                "  --repeat <次数>      每个阶段重复次数，取最快一次，默认 5\n"
+                "  -b <MiB>             区块大小，默认 1\n"
+                "  -l <级别>            压缩级别\n"
+                "  --sampled --interleave --context  同 c 子命令\n"
+                "  -o <路径>            结果写入文件而不是标准输出\n";
+    }
+}
+
+int main(int argc, char** argv) {
+    using namespace Lzip::Bench;
+    Options options;
+    const vector<string> args(argv + 1, argv + argc);
+    double tolerance = 5;
+    string compareBase, compareNew;
+    for (u64 i = 0; i < args.size(); i++) {
+        const string& arg = args[i];
+        const bool hasValue = i + 1 < args.size();
+        const auto value = [&]() -> const string& { return args[++i]; };
+        try {
+            if (arg == "--compare" && i + 2 < args.size()) {
+                compareBase = value();
+                compareNew = value();
+            }
+            else if (arg == "--tolerance" && hasValue) tolerance = std::stod(value());
+            else if (arg == "--corpus" && hasValue) options.corpora.push_back(value());
+            else if (arg == "--file" && hasValue) options.files.push_back(value());
+            else if (arg == "--size" && hasValue) options.corpusSize = std::stoull(value()) << 20;
+            else if (arg == "--repeat" && hasValue) options.repeats = std::max<u32>(1, static_cast<u32>(std::stoul(value())));
+            else if (arg == "-b" && hasValue) options.compress.blockSize = std::clamp<u64>(std::stoull(value()) << 20, Lzip::Container::MIN_BLOCK_SIZE, Lzip::Container::MAX_BLOCK_SIZE);
+            else if (arg == "-l" && hasValue) options.compress.level = std::min<u32>(static_cast<u32>(std::stoul(value())), Lzip::Lz77::MAX_LEVEL);
+            else if (arg == "--sampled") options.compress.sampledHistogram = true;
+            else if (arg == "--interleave") options.compress.interleaved = true;
+            else if (arg == "--context") options.compress.contextModel = true;
+            else if (arg == "-o" && hasValue) options.output = value();
+            else {
+                printUsage();
+                return arg == "-h" || arg == "--help" ? 0 : 2;
+            }
+        }
+        catch (const std::exception&) {
+            cerr << "参数有误：" << arg << '\n';
+            return 2;
+        }
+    }
+    if (!compareBase.empty()) return compareResults(compareBase, compareNew, tolerance);
+    vector<Corpus> corpora;
+    if (!loadCorpora(options, corpora)) return 2;
+    vector<Result> results;
+    for (const Corpus& corpus : corpora) {
+        if (corpus.data.empty()) continue;
+        cerr << "正在测试 " << corpus.name << '\n';
+        if (!runCorpus(corpus, options, results)) return 1;
+    }
+    if (options.output.empty()) writeResults(cout, options, results);
+    else {
+        std::ofstream out(options.output);
+        writeResults(out, options, results);
+        if (!out) {
+            cerr << "无法写入结果文件：" << options.output << '\n';
+            return 2;
+        }
+    }
+    return 0;
+}
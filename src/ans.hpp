@@ -0,0 +1,156 @@
+﻿#pragma once
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cmath>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+//Table-based asymmetric numeral system (tANS) over bytes:
+//  each symbol owns as many of the `TABLE_SIZE` states as its normalized count, so it costs log2(TABLE_SIZE / count) bits on average, fractions included
+//  encoding runs back to front and so does its bitstream, which lets decoding read forward like the Huffman blocks
+namespace Lzip::Ans {
+    typedef uint8_t u8;
+    typedef uint16_t u16;
+    typedef uint32_t u32;
+    typedef uint64_t u64;
+    using std::array, std::span, std::vector;
+
+    //4096 states: a 16 KiB decode table that stays in L1, and a probability resolution of 1/4096 per byte
+    inline constexpr u32 TABLE_LOG = 12, TABLE_SIZE = 1u << TABLE_LOG;
+    //Two states take turns, even bytes use the first and odd bytes the second, so a decoder has two independent chains in flight
+    inline constexpr u32 STATE_COUNT = 2;
+    //Every count takes `COUNT_BITS`, one more than `TABLE_LOG` so a single symbol can own the whole table
+    inline constexpr u32 COUNT_BITS = TABLE_LOG + 1, TABLE_BYTES = (256 * COUNT_BITS + 7) / 8;
+
+    typedef array<u16, 256> NormalizedCounts;
+
+    struct EncodeSymbol {
+        //`(state + deltaBits) >> 16` is the number of bits to emit, which only depends on the state's range
+        u32 deltaBits{0};
+        //Offset of the symbol's slice of `EncodeTable::nextState`
+        int32_t deltaState{0};
+    };
+
+    struct EncodeTable {
+        array<EncodeSymbol, 256> symbols{};
+        array<u16, TABLE_SIZE> nextState{};
+    };
+
+    //Decoding a state yields its byte, then `bits` more bits are read and added to `baseState` to form the next state
+    struct DecodeEntry {
+        u16 baseState{0};
+        u8 symbol{0}, bits{0};
+    };
+
+    struct DecodeTable {
+        array<DecodeEntry, TABLE_SIZE> entries{};
+    };
+
+    //Scales `frequencies` to counts summing to `TABLE_SIZE`, every byte that occurs keeps at least 1; false if none occurs
+    [[nodiscard]] inline bool normalize(const array<u64, 256>& frequencies, NormalizedCounts& counts) noexcept {
+        u64 total = 0;
+        for (const u64 frequency : frequencies) total += frequency;
+        counts.fill(0);
+        if (total == 0) return false;
+        int32_t remaining = TABLE_SIZE;
+        for (u32 i = 0; i < 256; i++) if (frequencies[i] > 0) {
+            //Rounded, a byte that would round to 0 still needs a state
+            const u64 scaled = (frequencies[i] * TABLE_SIZE + total / 2) / total;
+            counts[i] = static_cast<u16>(std::max<u64>(1, scaled));
+            remaining -= counts[i];
+        }
+        //Rounding leaves a few states over or short, they go to or come from the largest counts, where they change the cost the least
+        while (remaining != 0) {
+            u32 largest = 0;
+            for (u32 i = 1; i < 256; i++) if (counts[i] > counts[largest]) largest = i;
+            if (remaining > 0) {
+                counts[largest] = static_cast<u16>(counts[largest] + remaining);
+                break;
+            }
+            //At most 256 counts of 1 can't exceed the table, so the largest always has some to spare
+            const int32_t taken = std::min<int32_t>(-remaining, std::max<int32_t>(1, counts[largest] / 8));
+            if (counts[largest] <= taken) return false;
+            counts[largest] = static_cast<u16>(counts[largest] - taken);
+            remaining += taken;
+        }
+        return true;
+    }
+
+    //Bits the payload will take, from the ideal cost of each byte under `counts`
+    [[nodiscard]] inline u64 estimateBits(const array<u64, 256>& frequencies, const NormalizedCounts& counts) noexcept {
+        double bits = 0;
+        for (u32 i = 0; i < 256; i++) if (frequencies[i] > 0) bits += static_cast<double>(frequencies[i]) * (TABLE_LOG - std::log2(static_cast<double>(counts[i])));
+        return static_cast<u64>(bits) + STATE_COUNT * TABLE_LOG;
+    }
+
+    //Which symbol every state belongs to; stepping by a fixed odd stride scatters each symbol's states over the whole table
+    inline void spreadSymbols(const NormalizedCounts& counts, array<u8, TABLE_SIZE>& symbols) noexcept {
+        constexpr u32 STEP = (TABLE_SIZE >> 1) + (TABLE_SIZE >> 3) + 3, MASK = TABLE_SIZE - 1;
+        u32 position = 0;
+        for (u32 symbol = 0; symbol < 256; symbol++) for (u32 i = 0; i < counts[symbol]; i++) {
+            symbols[position] = static_cast<u8>(symbol);
+            position = (position + STEP) & MASK;
+        }
+    }
+
+    inline void buildEncodeTable(const NormalizedCounts& counts, EncodeTable& table) noexcept {
+        array<u8, TABLE_SIZE> symbols;
+        spreadSymbols(counts, symbols);
+        array<u32, 256> cumulative{};
+        u32 total = 0;
+        for (u32 symbol = 0; symbol < 256; symbol++) {
+            cumulative[symbol] = total;
+            EncodeSymbol& entry = table.symbols[symbol];
+            if (counts[symbol] == 0) {
+                entry = {};
+                continue;
+            }
+            //States from `count << bits` up emit `bits` bits, the ones below emit one fewer
+            const u32 bits = TABLE_LOG - (counts[symbol] == 1 ? 0 : std::bit_width(static_cast<u32>(counts[symbol] - 1)) - 1);
+            entry.deltaBits = (bits << 16) - (static_cast<u32>(counts[symbol]) << bits);
+            entry.deltaState = static_cast<int32_t>(total) - static_cast<int32_t>(counts[symbol]);
+            total += counts[symbol];
+        }
+        for (u32 state = 0; state < TABLE_SIZE; state++) table.nextState[cumulative[symbols[state]]++] = static_cast<u16>(TABLE_SIZE + state);
+    }
+
+    //False when `counts` don't add up to `TABLE_SIZE`, which a valid block never has
+    [[nodiscard]] inline bool buildDecodeTable(const NormalizedCounts& counts, DecodeTable& table) noexcept {
+        u32 total = 0;
+        for (const u16 count : counts) total += count;
+        if (total != TABLE_SIZE) return false;
+        array<u8, TABLE_SIZE> symbols;
+        spreadSymbols(counts, symbols);
+        array<u32, 256> next{};
+        for (u32 symbol = 0; symbol < 256; symbol++) next[symbol] = counts[symbol];
+        for (u32 state = 0; state < TABLE_SIZE; state++) {
+            const u8 symbol = symbols[state];
+            //The encoder reached this state from one in [x << bits, (x + 1) << bits) for the x-th state of the symbol
+            const u32 x = next[symbol]++;
+            const u32 bits = TABLE_LOG - (std::bit_width(x) - 1);
+            table.entries[state] = {static_cast<u16>((x << bits) - TABLE_SIZE), symbol, static_cast<u8>(bits)};
+        }
+        return true;
+    }
+
+    inline void serialize(const NormalizedCounts& counts, vector<u8>& data) noexcept {
+        u32 bitBuffer = 0, bitCount = 0;
+        for (const u16 count : counts) {
+            bitBuffer = bitBuffer << COUNT_BITS | count;
+            bitCount += COUNT_BITS;
+            for (; bitCount >= 8; bitCount -= 8) data.push_back(static_cast<u8>(bitBuffer >> (bitCount - 8)));
+        }
+        if (bitCount > 0) data.push_back(static_cast<u8>(bitBuffer << (8 - bitCount)));
+    }
+
+    inline void deserialize(span<const u8> table, NormalizedCounts& counts) noexcept {
+        u32 bitBuffer = 0, bitCount = 0, position = 0;
+        for (u16& count : counts) {
+            for (; bitCount < COUNT_BITS; bitCount += 8) bitBuffer = bitBuffer << 8 | table[position++];
+            count = static_cast<u16>((bitBuffer >> (bitCount - COUNT_BITS)) & ((1u << COUNT_BITS) - 1));
+            bitCount -= COUNT_BITS;
+        }
+    }
+}
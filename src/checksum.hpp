@@ -0,0 +1,132 @@
+﻿#pragma once
+#include <array>
+#include <cstdint>
+#include <span>
+
+#include "utils.hpp"
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+    #define _LZIP_SSE42 1
+    #define _LZIP_SSE42_TARGET __attribute__((target("sse4.2")))
+    #include <nmmintrin.h> // IWYU pragma: keep
+#elif defined(_M_X64) && defined(_MSC_VER)
+    #define _LZIP_SSE42 1
+    #define _LZIP_SSE42_TARGET
+    #include <nmmintrin.h> // IWYU pragma: keep
+    #include <intrin.h> // IWYU pragma: keep
+#endif
+
+//CRC-32C (Castagnoli), the checksum SSE 4.2 computes in hardware; slicing-by-8 tables elsewhere
+//CRCs of neighbouring pieces combine into the CRC of their concatenation without touching the data again
+//Blocks are hashed in a pass of their own, just before encoding or just after decoding while they're still in L2, not inside the coders' loops
+//That pass costs 2-5% of Huffman coding time; hashing 16 KiB strides from inside the loops measured no faster, since every call pays for joining its lanes
+namespace Lzip::Checksum {
+    typedef uint8_t u8;
+    typedef uint32_t u32;
+    typedef uint64_t u64;
+    using std::array, std::span;
+
+    //Reflected, bit 31 is the coefficient of x^0
+    inline constexpr u32 POLYNOMIAL = 0x82F63B78u;
+
+    //`TABLES[k][b]` advances the register over byte `b` followed by `k` zero bytes
+    inline constexpr array<array<u32, 256>, 8> TABLES = [] {
+        array<array<u32, 256>, 8> tables{};
+        for (u32 byte = 0; byte < 256; byte++) {
+            u32 crc = byte;
+            for (u32 bit = 0; bit < 8; bit++) crc = crc & 1 ? (crc >> 1) ^ POLYNOMIAL : crc >> 1;
+            tables[0][byte] = crc;
+        }
+        for (u32 k = 1; k < 8; k++) for (u32 byte = 0; byte < 256; byte++) tables[k][byte] = (tables[k - 1][byte] >> 8) ^ tables[0][tables[k - 1][byte] & 0xFF];
+        return tables;
+    }();
+
+    //Product of two polynomials modulo the CRC polynomial, both reflected
+    [[nodiscard]] constexpr u32 multiplyModP(u32 a, u32 b) noexcept {
+        u32 product = 0;
+        for (u32 mask = 1u << 31; mask != 0; mask >>= 1) {
+            if (a & mask) product ^= b;
+            b = b & 1 ? (b >> 1) ^ POLYNOMIAL : b >> 1;
+        }
+        return product;
+    }
+
+    //`POWERS[k]` is x^(2^k) modulo the polynomial
+    inline constexpr array<u32, 64> POWERS = [] {
+        array<u32, 64> powers{};
+        powers[0] = 1u << 30;
+        for (u32 k = 1; k < 64; k++) powers[k] = multiplyModP(powers[k - 1], powers[k - 1]);
+        return powers;
+    }();
+
+    //What `length` zero bytes do to a register: multiply it by x^(8 * length)
+    [[nodiscard]] constexpr u32 shift(u32 crc, u64 length) noexcept {
+        for (u32 k = 3; length != 0 && k < 64; length >>= 1, k++) if (length & 1) crc = multiplyModP(POWERS[k], crc);
+        return crc;
+    }
+
+    //Registers are kept inverted between calls, as the standard CRC-32C starts and ends with all ones
+    [[nodiscard]] inline u32 updatePortable(u32 crc, span<const u8> data) noexcept {
+        const u8* in = data.data();
+        u64 size = data.size();
+        for (; size >= 8; in += 8, size -= 8) {
+            const u64 word = Util::readIntLE<u64>(in) ^ crc;
+            crc = TABLES[7][word & 0xFF] ^ TABLES[6][(word >> 8) & 0xFF] ^ TABLES[5][(word >> 16) & 0xFF] ^ TABLES[4][(word >> 24) & 0xFF] ^
+                TABLES[3][(word >> 32) & 0xFF] ^ TABLES[2][(word >> 40) & 0xFF] ^ TABLES[1][(word >> 48) & 0xFF] ^ TABLES[0][word >> 56];
+        }
+        for (; size > 0; in++, size--) crc = TABLES[0][(crc ^ *in) & 0xFF] ^ (crc >> 8);
+        return crc;
+    }
+
+#if _LZIP_SSE42
+    //Below this the three lanes don't pay for combining them
+    inline constexpr u64 LANES_MIN_SIZE = 3 * 4096;
+
+    //`crc32` has a latency of 3 cycles but issues every cycle, so three independent lanes keep it busy; they are joined with `shift`
+    [[nodiscard]] _LZIP_SSE42_TARGET inline u32 updateSse42(u32 crc, span<const u8> data) noexcept {
+        const u8* in = data.data();
+        u64 size = data.size();
+        u64 state = crc;
+        if (size >= LANES_MIN_SIZE) {
+            const u64 lane = size / 24 * 8;
+            u64 second = 0, third = 0;
+            for (u64 i = 0; i < lane; i += 8) {
+                state = _mm_crc32_u64(state, Util::readIntLE<u64>(in + i));
+                second = _mm_crc32_u64(second, Util::readIntLE<u64>(in + lane + i));
+                third = _mm_crc32_u64(third, Util::readIntLE<u64>(in + 2 * lane + i));
+            }
+            state = shift(static_cast<u32>(state), 2 * lane) ^ shift(static_cast<u32>(second), lane) ^ third;
+            in += 3 * lane;
+            size -= 3 * lane;
+        }
+        for (; size >= 8; in += 8, size -= 8) state = _mm_crc32_u64(state, Util::readIntLE<u64>(in));
+        for (; size > 0; in++, size--) state = _mm_crc32_u8(static_cast<u32>(state), *in);
+        return static_cast<u32>(state);
+    }
+
+    [[nodiscard]] inline bool detectSse42() noexcept {
+    #if defined(_MSC_VER) && !defined(__clang__)
+        int info[4];
+        __cpuid(info, 1);
+        return (info[2] & (1 << 20)) != 0;
+    #else
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("sse4.2");
+    #endif
+    }
+
+    //Checked once at startup
+    inline const bool HAS_SSE42 = detectSse42();
+#endif
+
+    //CRC-32C of `data`, continuing from `crc`, the CRC of whatever came before it
+    [[nodiscard]] inline u32 crc32c(span<const u8> data, u32 crc = 0) noexcept {
+    #if _LZIP_SSE42
+        if (HAS_SSE42) return ~updateSse42(~crc, data);
+    #endif
+        return ~updatePortable(~crc, data);
+    }
+
+    //CRC-32C of the concatenation of a piece with CRC `first` and one of `secondLength` bytes with CRC `second`
+    [[nodiscard]] constexpr u32 combine(u32 first, u32 second, u64 secondLength) noexcept { return shift(first, secondLength) ^ second; }
+}
@@ -1,14 +1,19 @@
 ﻿#pragma once
+#include <algorithm>
 #include <array>
-#include <chrono>
-#include <filesystem>
-#include <iostream>
+#include <bit>
+#include <cstring>
 #include <span>
-#include <string>
 #include <vector>
 
+#include "ans.hpp"
+#include "container.hpp"
+#include "context.hpp"
 #include "huffman.hpp"
-#include "meta.hpp"
+#include "lz77.hpp"
+#include "options.hpp"
+#include "preset.hpp"
+#include "stats.hpp"
 #include "utils.hpp"
 
 namespace Lzip {
@@ -16,157 +21,440 @@ namespace Lzip {
     typedef uint16_t u16;
     typedef uint32_t u32;
     typedef uint64_t u64;
-    using std::array, std::cout, std::cin, std::fixed, std::setprecision, std::to_string, std::string, std::vector, std::span, std::filesystem::path, std::chrono::steady_clock, std::chrono::duration_cast, std::chrono::milliseconds, Util::FileReader, Util::FileWriter, Util::normalize, Util::IO_CHUNK_SIZE, Util::printCodes, Huffman::HuffmanCode, Huffman::updateFrequency, Huffman::getHuffmanCode;
-    inline void compress(vector<u8>& result, span<const u8> input, const array<HuffmanCode, 256>& huffmanCodes, u8& previousOffset) noexcept;
-
-    [[nodiscard]] inline bool compressFile(const string& inputFile, const string& outputFile) noexcept {
-        steady_clock::time_point startTime = steady_clock::now();
-        path inputPath(inputFile);
-        if (!normalize(inputPath)) {
-            Util::setError(string("输入文件路径有误：") + inputFile);
-            return false;
-        }
-        path outputPath = outputFile.empty() ? inputFile + ".lzip" : outputFile;
-        if (!normalize(outputPath)) {
-            Util::setError(string("输出文件路径有误：") + outputFile);
-            return false;
-        }
-        if (exists(outputPath) && is_regular_file(outputPath)) {
-            cout << "输出文件 \"" << STR(outputPath) << "\" 已存在，是否覆盖？(y/n)：";
-            string input;
-            cin >> input;
-            if (input != "y" && input != "Y") {
-                cout << "操作已取消。\n";
-                return true;
-            }
+    using std::array, std::vector, std::span, Huffman::HuffmanCode, Huffman::updateFrequency, Huffman::getHuffmanCode, Container::BlockType;
+
+    //A block is stored as is unless coding it saves at least 1/64 of its size
+    inline constexpr u32 MIN_GAIN_SHIFT = 6;
+
+    //Bits that don't fill a whole byte yet, kept left-aligned in `bitBuffer` and carried between input chunks
+    struct EncoderState {
+        u64 bitBuffer{0};
+        u32 bitCount{0};
+    };
+
+    //Scratch that block coding reuses from one block to the next rather than allocating and zeroing it every time
+    struct EncodeWorkspace {
+        Lz77::MatchFinder finder;
+        vector<Lz77::Sequence> sequences;
+        vector<u32> pairCounts;
+
+        //Most a workspace grows to with these options, only the coders they enable use theirs
+        [[nodiscard]] static u64 bound(const CompressOptions& options) noexcept {
+            const u64 window = u64(1) << std::min<u64>(options.windowLog, std::bit_width(options.blockSize - 1));
+            const u64 lz77 = ((u64(1) << Lz77::MatchFinder::HASH_LOG) + window) * sizeof(u32) + (options.blockSize / Lz77::MIN_MATCH + 1) * sizeof(Lz77::Sequence);
+            return (options.level > 0 ? lz77 : 0) + (options.contextModel ? 256 * 256 * sizeof(u32) : 0);
         }
-        FileReader reader(inputPath);
-        if (!reader.file.is_open()) {
-            Util::setError(string("无法打开输入文件：") + reinterpret_cast<const char*>(inputPath.u8string().c_str()));
-            return false;
-        }
-        FileWriter writer(outputPath);
-        if (!writer.file.is_open()) {
-            Util::setError(string("无法打开输出文件：") + reinterpret_cast<const char*>(outputPath.u8string().c_str()));
-            return false;
-        }
-        static array<u64, 256> frequencies{};
-        frequencies.fill(0);
-        //Get byte frequencies
-        vector<u8> inputData_header;
-        u64 length = reader.nextChunk(inputData_header, IO_CHUNK_SIZE), ax = 0;
-        while (true) {
-            if (length == 0) break;
-            if ((ax & 63) == 0) cout << "正在统计区块 #" + to_string(ax) << '\n';
-            updateFrequency(inputData_header, frequencies);
-            inputData_header.clear();
-            length = reader.nextChunk(inputData_header, IO_CHUNK_SIZE);
-            ax++;
-        }
-        ax = 0;
-        //Generate Huffman codes
-        static array<HuffmanCode, 256> huffmanCodes;
-        huffmanCodes.fill({});
-        u16 presentedByteCount;
-        if (!getHuffmanCode(frequencies, huffmanCodes, presentedByteCount)) {
-            Util::setError("无法生成霍夫曼树。");
-            return false;
-        }
-        printCodes(huffmanCodes);
-        inputData_header.insert(inputData_header.end(), LZIP_MAGIC.begin(), LZIP_MAGIC.end());
-        Util::writeIntLE(inputData_header, LZIP_VERSION);
-        Util::writeIntLE(inputData_header, static_cast<u64>(reader.fileSize));
-        Huffman::serialize(huffmanCodes, inputData_header);
-        writer.writeChunk(inputData_header);
-        if (presentedByteCount > 0) {
-            reader.reset();
-            inputData_header.clear();
-            vector<u8> outputData;
-            length = reader.nextChunk(inputData_header, IO_CHUNK_SIZE);
-            u8 offset = 0;
-            while (true) {
-                if (length == 0) break;
-                if ((ax & 255) == 0) cout << "正在压缩区块 #" + to_string(ax) << '\n';
-                compress(outputData, inputData_header, huffmanCodes, offset);
-                if (offset > 0) {
-                    u8 lastByte = outputData.back();
-                    outputData.pop_back();
-                    writer.writeChunk(outputData);
-                    outputData.clear();
-                    outputData.push_back(lastByte);
-                }
-                else {
-                    writer.writeChunk(outputData);
-                    outputData.clear();
-                }
-                inputData_header.clear();
-                length = reader.nextChunk(inputData_header, IO_CHUNK_SIZE);
-                ax++;
-            }
-            if (outputData.size() > 0) writer.writeChunk(outputData);
+    };
+
+    //One per thread, so pool workers and `Encoder`s on the same thread share it and nothing is locked
+    [[nodiscard]] inline EncodeWorkspace& encodeWorkspace() noexcept {
+        thread_local EncodeWorkspace workspace;
+        return workspace;
+    }
+
+    inline void compress(vector<u8>& result, span<const u8> input, const array<HuffmanCode, 256>& huffmanCodes, EncoderState& state) noexcept;
+    inline void finishCompress(vector<u8>& result, EncoderState& state) noexcept;
+    inline void compressBlock(span<const u8> input, vector<u8>& result, const CompressOptions& options, Util::CodingStats* stats = nullptr) noexcept;
+    inline void compressLz77Block(span<const u8> input, vector<u8>& result, const Lz77::Level& level, u32 windowLog, EncodeWorkspace& workspace) noexcept;
+    inline void compressAnsBlock(span<const u8> input, const Ans::NormalizedCounts& counts, vector<u8>& result) noexcept;
+    inline void compressContextBlock(span<const u8> input, const Context::Model& model, vector<u8>& result) noexcept;
+    inline void compressPresetBlock(span<const u8> input, const Preset::Table& preset, const CompressOptions& options, vector<u8>& result) noexcept;
+
+    //A code and its length as `code << 5 | codeLen`, so a byte table takes 1 KiB of cache instead of 4
+    typedef array<u32, 256> PackedCodes;
+
+    //Codes `input` with a table whose codes are at most `MAX_LEN` bits long: as many codes as fit beside 7 pending bits go into the accumulator before each store
+    //`out` needs 8 bytes of room past the last whole byte
+    template <u32 MAX_LEN>
+    inline void encodeKernel(span<const u8> input, const PackedCodes& codes, u8*& out, EncoderState& state) noexcept {
+        constexpr u32 CODES_PER_STORE = (64 - 7) / MAX_LEN;
+        u64 bitBuffer = state.bitBuffer;
+        u32 bitCount = state.bitCount;
+        const auto put = [&codes, &bitBuffer, &bitCount](u8 byte) _LZIP_FORCE_INLINE {
+            const u32 entry = codes[byte], length = entry & 31;
+            bitBuffer |= static_cast<u64>(entry >> 5) << (64 - length - bitCount);
+            bitCount += length;
+        };
+        const auto store = [&out, &bitBuffer, &bitCount]() _LZIP_FORCE_INLINE {
+            Util::storeBE64(out, bitBuffer);
+            out += bitCount >> 3;
+            bitBuffer <<= bitCount & ~7u;
+            bitCount &= 7;
+        };
+        u64 i = 0;
+        for (; i + CODES_PER_STORE <= input.size(); i += CODES_PER_STORE) {
+            for (u32 j = 0; j < CODES_PER_STORE; j++) put(input[i + j]);
+            store();
+        }
+        for (; i < input.size(); i++) {
+            put(input[i]);
+            store();
         }
-        cout << "压缩完成，耗时 " << duration_cast<milliseconds>(steady_clock::now() - startTime).count() << " 毫秒\n输出文件：" << reinterpret_cast<const char*>(outputPath.u8string().c_str()) << "\n压缩比：" << fixed << setprecision(2) << (static_cast<double>(writer.fileSize()) / reader.fileSize) * 100 << "%\n";
-        return true;
+        state.bitBuffer = bitBuffer;
+        state.bitCount = bitCount;
     }
 
-    inline void compress(vector<u8>& result, span<const u8> input, const array<HuffmanCode, 256>& huffmanCodes, u8& previousOffset) noexcept {
+    typedef void (*EncodeKernel)(span<const u8>, const PackedCodes&, u8*&, EncoderState&) noexcept;
+    //Indexed by `Huffman::kernelIndex`
+    inline constexpr array<EncodeKernel, Huffman::KERNEL_COUNT> ENCODE_KERNELS{encodeKernel<Huffman::KERNEL_CODE_LENS[0]>, encodeKernel<Huffman::KERNEL_CODE_LENS[1]>, encodeKernel<Huffman::KERNEL_CODE_LENS[2]>, encodeKernel<Huffman::KERNEL_CODE_LENS[3]>};
+
+    //Appends whole bytes only, the last partial byte stays in `state` until `finishCompress`
+    inline void compress(vector<u8>& result, span<const u8> input, const array<HuffmanCode, 256>& huffmanCodes, EncoderState& state) noexcept {
         if (input.size() == 0) return;
-        u64 cursor;
-        switch (result.size()) {
-            case 0:
-                cursor = 0;
-                break;
-            case 1:
-                cursor = previousOffset;
-                break;
-            default:
-                cursor = ((result.size() - 1) << 3) + previousOffset;
-                break;
-        }
-        for (u64 i = 0; i < input.size(); i++) {
-            const u8 byte = input[i], length = huffmanCodes[byte].codeLen;
-            const u64 code = huffmanCodes[byte].code, newCursor = cursor + length;
-            //We're crossing byte boundary
-            if (cursor == 0 || (newCursor - 1) >> 3 > (cursor - 1) >> 3) [[unlikely]] {
-                u8 bitsLeft;
-                //We will write to a brand new byte
-                if ((cursor & 7) == 0) {
-                    result.push_back(0);
-                    if (length > 8) [[unlikely]] {
-                        result[cursor >> 3] |= static_cast<u8>(code >> (length - 8));
-                        cursor += 8;
-                        bitsLeft = length - 8;
-                    }
-                    //Length is less than 8, so just write and continue
-                    else [[likely]] {
-                        result[cursor >> 3] |= static_cast<u8>(code << (8 - length));
-                        cursor = newCursor;
-                        continue;
-                    }
-                }
-                //We will also be writing to the old byte
-                else {
-                    const u8 bitsInLastByte = 8 - static_cast<u8>(cursor & 7);
-                    result[cursor >> 3] |= static_cast<u8>(code >> (length - bitsInLastByte));
-                    cursor += bitsInLastByte;
-                    bitsLeft = length - bitsInLastByte;
-                }
-                while (bitsLeft >= 8) {
-                    result.push_back(static_cast<u8>(code >> (bitsLeft - 8)));
-                    cursor += 8;
-                    bitsLeft -= 8;
-                }
-                if (bitsLeft > 0) {
-                    result.push_back(static_cast<u8>(code << (8 - bitsLeft)));
-                    cursor += bitsLeft;
+        u16 maxCodeLen = 0;
+        PackedCodes codes;
+        for (u32 i = 0; i < 256; i++) {
+            maxCodeLen = std::max(maxCodeLen, huffmanCodes[i].codeLen);
+            codes[i] = static_cast<u32>(huffmanCodes[i].code << 5) | huffmanCodes[i].codeLen;
+        }
+        //Every store writes a full word, so leave room for one past the last whole byte
+        const u64 oldSize = result.size();
+        result.resize(oldSize + ((input.size() * maxCodeLen) >> 3) + 16);
+        u8* out = result.data() + oldSize;
+        ENCODE_KERNELS[Huffman::kernelIndex(maxCodeLen)](input, codes, out, state);
+        result.resize(static_cast<u64>(out - result.data()));
+    }
+
+    //Pads the pending bits with zeros to a whole byte
+    inline void finishCompress(vector<u8>& result, EncoderState& state) noexcept {
+        if (state.bitCount > 0) result.push_back(static_cast<u8>(state.bitBuffer >> 56));
+        state = {};
+    }
+
+    //Appends codes MSB-first, `out` needs 8 bytes of room past the last whole byte and `count` must be at least 1
+    inline void putBits(u8*& out, EncoderState& state, u64 bits, u32 count) noexcept {
+        state.bitBuffer |= bits << (64 - count - state.bitCount);
+        state.bitCount += count;
+        Util::storeBE64(out, state.bitBuffer);
+        out += state.bitCount >> 3;
+        state.bitBuffer <<= state.bitCount & ~7u;
+        state.bitCount &= 7;
+    }
+
+    //Sub-stream `index` of a `BlockType::Huffman4` block codes this part of the input
+    [[nodiscard]] inline span<const u8> streamSegment(span<const u8> input, u64 index) noexcept {
+        const u64 segmentSize = (input.size() + Container::STREAM_COUNT - 1) / Container::STREAM_COUNT, offset = std::min<u64>(input.size(), index * segmentSize);
+        return input.subspan(offset, std::min<u64>(input.size() - offset, segmentSize));
+    }
+
+    //Codes each quarter of `input` into its own sub-stream, advancing the four accumulators in lockstep so their stores don't wait on each other
+    //`out` must have room for exactly the sum of `streamSizes`, each of which has to be the coded size of its quarter
+    inline void compressStreams(span<const u8> input, const array<HuffmanCode, 256>& huffmanCodes, const array<u64, Container::STREAM_COUNT>& streamSizes, u8* out) noexcept {
+        struct Stream {
+            span<const u8> input;
+            u64 position{0};
+            u8* out{nullptr};
+            u8* end{nullptr};
+            EncoderState state;
+        };
+        array<Stream, Container::STREAM_COUNT> streams;
+        for (u32 i = 0; i < Container::STREAM_COUNT; i++) {
+            streams[i].input = streamSegment(input, i);
+            streams[i].out = out;
+            streams[i].end = out += streamSizes[i];
+        }
+        //A full word store never reaches into the next sub-stream
+        const auto canStep = [](const Stream& stream) { return stream.position + 2 <= stream.input.size() && stream.out + 8 <= stream.end; };
+        const auto step = [&huffmanCodes](Stream& stream) _LZIP_FORCE_INLINE {
+            const HuffmanCode& first = huffmanCodes[stream.input[stream.position]];
+            const HuffmanCode& second = huffmanCodes[stream.input[stream.position + 1]];
+            stream.position += 2;
+            //Two codes of up to `MAX_CODE_LEN` bits go out with one store
+            putBits(stream.out, stream.state, first.code << second.codeLen | second.code, first.codeLen + second.codeLen);
+        };
+        while (canStep(streams[0]) && canStep(streams[1]) && canStep(streams[2]) && canStep(streams[3])) {
+            step(streams[0]);
+            step(streams[1]);
+            step(streams[2]);
+            step(streams[3]);
+        }
+        //The last few bytes of each sub-stream go out one at a time
+        for (Stream& stream : streams) {
+            for (; stream.position < stream.input.size(); stream.position++) {
+                const HuffmanCode& code = huffmanCodes[stream.input[stream.position]];
+                stream.state.bitBuffer |= code.code << (64 - code.codeLen - stream.state.bitCount);
+                stream.state.bitCount += code.codeLen;
+                for (; stream.state.bitCount >= 8; stream.state.bitCount -= 8) {
+                    *stream.out++ = static_cast<u8>(stream.state.bitBuffer >> 56);
+                    stream.state.bitBuffer <<= 8;
                 }
             }
-            //We're staying in the same byte
-            else [[likely]] {
-                result[cursor >> 3] |= static_cast<u8>(code << (8 - length - static_cast<u8>(cursor & 7)));
-                cursor = newCursor;
+            if (stream.state.bitCount > 0) *stream.out++ = static_cast<u8>(stream.state.bitBuffer >> 56);
+        }
+    }
+
+    //Appends one self-contained block: header, table and payload, coded with whichever of Huffman, tANS and LZ77 (when `options.level` > 0) comes out smallest
+    //Blocks of one repeated byte become `BlockType::Rle`, blocks no coder shrinks by enough become `BlockType::Stored`
+    //With `options.sampledHistogram` the frequencies are only estimated, so payload sizes are taken from the coded output instead
+    //With `options.preset`, blocks up to `Preset::MAX_BLOCK_SIZE` bytes skip the histogram and every table but LZ77's, see `compressPresetBlock`
+    inline void compressBlock(span<const u8> input, vector<u8>& result, const CompressOptions& options, Util::CodingStats* stats) noexcept {
+        if (options.preset != 0 && input.size() <= Preset::MAX_BLOCK_SIZE) if (const Preset::Table* preset = Preset::find(options.preset)) {
+            compressPresetBlock(input, *preset, options, result);
+            return;
+        }
+        Util::StageClock clock;
+        EncodeWorkspace& workspace = encodeWorkspace();
+        //Sub-streams only pay for their jump table once each has a few words to decode
+        const bool interleaved = options.interleaved && input.size() >= Container::STREAM_COUNT * 64;
+        array<u64, 256> frequencies{};
+        array<array<u64, 256>, Container::STREAM_COUNT> streamFrequencies{};
+        if (options.sampledHistogram) Huffman::updateFrequencySampled(input, frequencies);
+        else if (interleaved) {
+            //Counted per quarter, the sub-stream sizes then come for free
+            for (u32 i = 0; i < Container::STREAM_COUNT; i++) {
+                updateFrequency(streamSegment(input, i), streamFrequencies[i]);
+                for (u32 j = 0; j < 256; j++) frequencies[j] += streamFrequencies[i][j];
             }
         }
-        previousOffset = static_cast<u8>(cursor & 7);
+        else updateFrequency(input, frequencies);
+        if (stats) stats->histogramTime = clock.lap();
+        array<HuffmanCode, 256> huffmanCodes;
+        u16 presentedByteCount;
+        getHuffmanCode(frequencies, huffmanCodes, presentedByteCount);
+        //A sampled histogram counts every byte at least once, so only the block itself tells whether it repeats one value; the scan stops at the first byte that differs
+        const bool singleByte = options.sampledHistogram ? std::find_if(input.begin(), input.end(), [first = input[0]](u8 byte) { return byte != first; }) == input.end() : presentedByteCount == 1;
+        u64 payloadBits = 0;
+        for (u16 i = 0; i < 256; i++) payloadBits += frequencies[i] * huffmanCodes[i].codeLen;
+        const u64 huffmanSize = Container::BLOCK_HEADER_SIZE + Container::HUFFMAN_TABLE_SIZE + (interleaved ? Container::STREAM_JUMP_TABLE_SIZE : 0) + ((payloadBits + 7) >> 3);
+        //tANS spends fractions of a bit per byte, which pays for its larger table once a few bytes are much more likely than the rest
+        Ans::NormalizedCounts ansCounts;
+        const u64 ansSize = Ans::normalize(frequencies, ansCounts) ? Container::BLOCK_HEADER_SIZE + Container::ANS_TABLE_SIZE + ((Ans::estimateBits(frequencies, ansCounts) + 8) >> 3) : UINT64_MAX;
+        //Order-1 tables see what the previous byte says about the next, which a single table can't
+        Context::Model contextModel;
+        const u64 contextSize = options.contextModel && !singleByte && Context::buildModel(input, contextModel, workspace.pairCounts) ? Container::BLOCK_HEADER_SIZE + Container::CONTEXT_TABLE_SIZE + ((contextModel.payloadBits + 7) >> 3) : UINT64_MAX;
+        if (stats) stats->tableTime = clock.lap();
+        if (singleByte) {
+            Container::writeBlockHeader(result, {BlockType::Rle, static_cast<u32>(input.size()), 1});
+            result.push_back(input[0]);
+            return;
+        }
+        const u64 storedSize = Container::BLOCK_HEADER_SIZE + input.size(), minGain = input.size() >> MIN_GAIN_SHIFT;
+        //Bytes spread this evenly are usually compressed already, LZ77 is only tried on them if a quick probe finds repeats
+        const bool incompressible = std::min({huffmanSize, ansSize, contextSize}) + minGain >= storedSize;
+        if (options.level > 0 && (!incompressible || Lz77::hasRepeats(input))) {
+            const u64 oldSize = result.size();
+            compressLz77Block(input, result, Lz77::LEVELS[std::min(options.level, Lz77::MAX_LEVEL)], options.windowLog, workspace);
+            if (result.size() - oldSize < std::min({huffmanSize, ansSize, contextSize, storedSize - minGain})) return;
+            result.resize(oldSize);
+        }
+        const auto store = [&input, &result] {
+            Container::writeBlockHeader(result, {BlockType::Stored, static_cast<u32>(input.size()), static_cast<u32>(input.size())});
+            result.insert(result.end(), input.begin(), input.end());
+        };
+        //Estimates can fall short of the coded size, by a little for tANS and by more for a sampled histogram, but no block may outgrow `storedSize`
+        const auto storeIfLarger = [&result, &store, storedSize](u64 blockStart) {
+            if (result.size() - blockStart <= storedSize) return;
+            result.resize(blockStart);
+            store();
+        };
+        if (incompressible) {
+            //LZ77 fell short, or wasn't tried
+            store();
+            return;
+        }
+        //Huffman decodes faster, so the other coders have to save at least 1/32 of the block to be worth it
+        if (contextSize != UINT64_MAX && contextSize + (huffmanSize >> 5) < std::min(huffmanSize, ansSize)) {
+            compressContextBlock(input, contextModel, result);
+            return;
+        }
+        if (ansSize + (huffmanSize >> 5) < huffmanSize) {
+            const u64 blockStart = result.size();
+            compressAnsBlock(input, ansCounts, result);
+            storeIfLarger(blockStart);
+            return;
+        }
+        if (interleaved) {
+            array<u64, Container::STREAM_COUNT> streamSizes{};
+            u64 payloadSize = 0;
+            for (u32 i = 0; i < Container::STREAM_COUNT; i++) {
+                u64 bits = 0;
+                if (options.sampledHistogram) for (const u8 byte : streamSegment(input, i)) bits += huffmanCodes[byte].codeLen;
+                else for (u32 j = 0; j < 256; j++) bits += streamFrequencies[i][j] * huffmanCodes[j].codeLen;
+                streamSizes[i] = (bits + 7) >> 3;
+                payloadSize += streamSizes[i];
+            }
+            const u64 blockStart = result.size();
+            Container::writeBlockHeader(result, {BlockType::Huffman4, static_cast<u32>(input.size()), static_cast<u32>(payloadSize)});
+            Huffman::serialize(huffmanCodes, result);
+            for (u32 i = 0; i + 1 < Container::STREAM_COUNT; i++) Util::writeIntLE(result, static_cast<u32>(streamSizes[i]));
+            const u64 payloadStart = result.size();
+            result.resize(payloadStart + payloadSize);
+            compressStreams(input, huffmanCodes, streamSizes, result.data() + payloadStart);
+            storeIfLarger(blockStart);
+            return;
+        }
+        const u64 headerOffset = result.size();
+        Container::writeBlockHeader(result, {BlockType::Huffman, static_cast<u32>(input.size()), static_cast<u32>((payloadBits + 7) >> 3)});
+        Huffman::serialize(huffmanCodes, result);
+        const u64 payloadStart = result.size();
+        EncoderState state;
+        compress(result, input, huffmanCodes, state);
+        finishCompress(result, state);
+        if (options.sampledHistogram) Util::writeIntLE(result.data() + headerOffset + 5, static_cast<u32>(result.size() - payloadStart));
+        storeIfLarger(headerOffset);
+    }
+
+    //Parses `input` into literals and matches, codes literal/length and distance symbols with a table each, then appends the block
+    inline void compressLz77Block(span<const u8> input, vector<u8>& result, const Lz77::Level& level, u32 windowLog, EncodeWorkspace& workspace) noexcept {
+        //A window wider than the block only costs memory
+        windowLog = std::clamp<u32>(std::min<u32>(windowLog, static_cast<u32>(std::bit_width(input.size() - 1))), Lz77::MIN_WINDOW_LOG, Lz77::MAX_WINDOW_LOG);
+        Lz77::MatchFinder& finder = workspace.finder;
+        finder.reset(windowLog);
+        vector<Lz77::Sequence>& sequences = workspace.sequences;
+        Lz77::parse(input, level, finder, sequences);
+        array<u64, Lz77::LITLEN_SYMBOLS> litlenFrequencies{};
+        array<u64, Lz77::DISTANCE_SYMBOLS> distanceFrequencies{};
+        u64 extraBits = 0, position = 0;
+        for (const Lz77::Sequence& sequence : sequences) {
+            for (u32 i = 0; i < sequence.literalCount; i++) litlenFrequencies[input[position + i]]++;
+            position += sequence.literalCount + sequence.matchLength;
+            if (sequence.matchLength == 0) continue;
+            const u32 lengthCode = Lz77::LENGTH_CODE[sequence.matchLength], distanceCode = Lz77::distanceCode(sequence.distance);
+            litlenFrequencies[Lz77::LITERAL_SYMBOLS + lengthCode]++;
+            distanceFrequencies[distanceCode]++;
+            extraBits += Lz77::LENGTH_EXTRA[lengthCode] + Lz77::distanceExtra(distanceCode);
+        }
+        array<HuffmanCode, Lz77::LITLEN_SYMBOLS> litlenCodes;
+        array<HuffmanCode, Lz77::DISTANCE_SYMBOLS> distanceCodes;
+        u16 presentedSymbolCount;
+        getHuffmanCode(litlenFrequencies, litlenCodes, presentedSymbolCount, Lz77::MAX_CODE_LEN);
+        getHuffmanCode(distanceFrequencies, distanceCodes, presentedSymbolCount, Lz77::MAX_CODE_LEN);
+        u64 payloadBits = extraBits;
+        for (u32 i = 0; i < Lz77::LITLEN_SYMBOLS; i++) payloadBits += litlenFrequencies[i] * litlenCodes[i].codeLen;
+        for (u32 i = 0; i < Lz77::DISTANCE_SYMBOLS; i++) payloadBits += distanceFrequencies[i] * distanceCodes[i].codeLen;
+        const u64 payloadSize = (payloadBits + 7) >> 3;
+        Container::writeBlockHeader(result, {BlockType::Lz77, static_cast<u32>(input.size()), static_cast<u32>(payloadSize)});
+        Lz77::serialize(litlenCodes, distanceCodes, result);
+        const u64 payloadStart = result.size();
+        result.resize(payloadStart + payloadSize + 8);
+        u8* out = result.data() + payloadStart;
+        EncoderState state;
+        position = 0;
+        for (const Lz77::Sequence& sequence : sequences) {
+            for (u32 i = 0; i < sequence.literalCount; i++) {
+                const HuffmanCode& code = litlenCodes[input[position + i]];
+                putBits(out, state, code.code, code.codeLen);
+            }
+            position += sequence.literalCount + sequence.matchLength;
+            if (sequence.matchLength == 0) continue;
+            //Each symbol goes out together with its extra bits
+            const u32 lengthCode = Lz77::LENGTH_CODE[sequence.matchLength], lengthExtra = Lz77::LENGTH_EXTRA[lengthCode];
+            const HuffmanCode& length = litlenCodes[Lz77::LITERAL_SYMBOLS + lengthCode];
+            putBits(out, state, length.code << lengthExtra | (sequence.matchLength - Lz77::LENGTH_BASE[lengthCode]), length.codeLen + lengthExtra);
+            const u32 distanceCode = Lz77::distanceCode(sequence.distance), distanceExtra = Lz77::distanceExtra(distanceCode);
+            const HuffmanCode& distance = distanceCodes[distanceCode];
+            putBits(out, state, distance.code << distanceExtra | (sequence.distance - Lz77::distanceBase(distanceCode)), distance.codeLen + distanceExtra);
+        }
+        if (state.bitCount > 0) *out++ = static_cast<u8>(state.bitBuffer >> 56);
+        result.resize(static_cast<u64>(out - result.data()));
+    }
+
+    //One pass over `input` with codes built when the table was added, then LZ77 when `options.level` asks for it, since repeats usually save far more than any table
+    //The smaller block is kept, or the bytes are stored when neither saves what the other coders have to
+    inline void compressPresetBlock(span<const u8> input, const Preset::Table& preset, const CompressOptions& options, vector<u8>& result) noexcept {
+        const u64 blockStart = result.size();
+        Container::writeBlockHeader(result, {BlockType::HuffmanPreset, static_cast<u32>(input.size()), 0});
+        Util::writeIntLE(result, preset.id);
+        const u64 payloadStart = result.size();
+        EncoderState state;
+        compress(result, input, preset.codes, state);
+        finishCompress(result, state);
+        Util::writeIntLE(result.data() + blockStart + 5, static_cast<u32>(result.size() - payloadStart));
+        if (options.level > 0) {
+            const u64 lz77Start = result.size();
+            compressLz77Block(input, result, Lz77::LEVELS[std::min(options.level, Lz77::MAX_LEVEL)], options.windowLog, encodeWorkspace());
+            if (result.size() - lz77Start < lz77Start - blockStart) result.erase(result.begin() + static_cast<std::ptrdiff_t>(blockStart), result.begin() + static_cast<std::ptrdiff_t>(lz77Start));
+            else result.resize(lz77Start);
+        }
+        if (result.size() - blockStart + (input.size() >> MIN_GAIN_SHIFT) < Container::BLOCK_HEADER_SIZE + input.size()) return;
+        result.resize(blockStart);
+        Container::writeBlockHeader(result, {BlockType::Stored, static_cast<u32>(input.size()), static_cast<u32>(input.size())});
+        result.insert(result.end(), input.begin(), input.end());
+    }
+
+    //Codes `input` with two tANS states taking turns; the encoder walks the bytes back to front, so it fills the payload from its end towards its start
+    inline void compressAnsBlock(span<const u8> input, const Ans::NormalizedCounts& counts, vector<u8>& result) noexcept {
+        Ans::EncodeTable table;
+        Ans::buildEncodeTable(counts, table);
+        const u64 headerOffset = result.size();
+        Container::writeBlockHeader(result, {BlockType::Ans, static_cast<u32>(input.size()), 0});
+        Ans::serialize(counts, result);
+        const u64 payloadStart = result.size();
+        //No byte costs more than `TABLE_LOG` bits, and a word store may reach 8 bytes below the last byte written
+        result.resize(payloadStart + 8 + ((input.size() * Ans::TABLE_LOG + Ans::STATE_COUNT * Ans::TABLE_LOG + 8) >> 3) + 1);
+        u8* const end = result.data() + result.size();
+        u8* out = end;
+        //Pending bits are right-aligned, a new code goes in front of them
+        u64 bitBuffer = 0;
+        u32 bitCount = 0;
+        const auto flush = [&]() {
+            Util::storeBE64(out - 8, bitBuffer);
+            out -= bitCount >> 3;
+            bitBuffer >>= bitCount & ~7u;
+            bitCount &= 7;
+        };
+        array<u32, Ans::STATE_COUNT> states;
+        states.fill(Ans::TABLE_SIZE);
+        const auto encode = [&](u64 index) _LZIP_FORCE_INLINE {
+            u32& state = states[index & 1];
+            const Ans::EncodeSymbol& symbol = table.symbols[input[index]];
+            const u32 bits = (state + symbol.deltaBits) >> 16;
+            bitBuffer |= static_cast<u64>(state & ((1u << bits) - 1)) << bitCount;
+            bitCount += bits;
+            state = table.nextState[(state >> bits) + symbol.deltaState];
+        };
+        u64 index = input.size();
+        for (; index % 4 != 0; index--) {
+            encode(index - 1);
+            flush();
+        }
+        //Four codes of up to `TABLE_LOG` bits plus 7 pending bits always fit in the accumulator
+        for (; index > 0; index -= 4) {
+            encode(index - 1);
+            encode(index - 2);
+            encode(index - 3);
+            encode(index - 4);
+            flush();
+        }
+        //The decoder starts from the final states, then a 1 bit marks where the zero padding in front of them ends
+        for (u32 i = Ans::STATE_COUNT; i-- > 0;) {
+            bitBuffer |= static_cast<u64>(states[i] - Ans::TABLE_SIZE) << bitCount;
+            bitCount += Ans::TABLE_LOG;
+            flush();
+        }
+        bitBuffer |= u64(1) << bitCount;
+        bitCount += 8;
+        flush();
+        const u64 payloadSize = static_cast<u64>(end - out);
+        std::memmove(result.data() + payloadStart, out, payloadSize);
+        result.resize(payloadStart + payloadSize);
+        Util::writeIntLE(result.data() + headerOffset + 5, static_cast<u32>(payloadSize));
+    }
+
+    //Codes each byte with the table its predecessor maps to, two codes of up to `Context::MAX_CODE_LEN` bits per store
+    inline void compressContextBlock(span<const u8> input, const Context::Model& model, vector<u8>& result) noexcept {
+        const u64 payloadSize = (model.payloadBits + 7) >> 3;
+        Container::writeBlockHeader(result, {BlockType::HuffmanContext, static_cast<u32>(input.size()), static_cast<u32>(payloadSize)});
+        Context::serialize(model, result);
+        const u64 payloadStart = result.size();
+        result.resize(payloadStart + payloadSize + 8);
+        array<const HuffmanCode*, 256> tables;
+        for (u32 context = 0; context < 256; context++) tables[context] = model.codes[model.map[context]].data();
+        u8* out = result.data() + payloadStart;
+        EncoderState state;
+        u8 previous = 0;
+        u64 i = 0;
+        for (; i + 1 < input.size(); i += 2) {
+            const HuffmanCode& first = tables[previous][input[i]];
+            const HuffmanCode& second = tables[input[i]][input[i + 1]];
+            previous = input[i + 1];
+            putBits(out, state, first.code << second.codeLen | second.code, first.codeLen + second.codeLen);
+        }
+        if (i < input.size()) {
+            const HuffmanCode& last = tables[previous][input[i]];
+            putBits(out, state, last.code, last.codeLen);
+        }
+        if (state.bitCount > 0) *out = static_cast<u8>(state.bitBuffer >> 56);
+        result.resize(payloadStart + payloadSize);
     }
 }
\ No newline at end of file
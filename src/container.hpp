@@ -0,0 +1,204 @@
+﻿#pragma once
+#include <algorithm>
+#include <array>
+#include <span>
+#include <vector>
+
+#include "ans.hpp"
+#include "checksum.hpp"
+#include "context.hpp"
+#include "lz77.hpp"
+#include "meta.hpp"
+#include "utils.hpp"
+
+//Layout of a version 3 file, all integers little-endian:
+//  header: magic, version (u32), max block size (u32)
+//  blocks: type (u8), original size (u32), payload size (u32), type-specific table, payload
+//    `BlockType::Huffman`: 256 code lengths, then the bytes coded with them
+//    `BlockType::Lz77`: literal/length and distance code lengths packed in nibbles, then literals and matches coded with them
+//    `BlockType::Huffman4`: 256 code lengths, sizes of the first 3 sub-streams (u32 each), then 4 sub-streams coding consecutive quarters of the bytes
+//    `BlockType::Ans`: 256 normalized counts of 13 bits each, then a 1 bit after zero padding, the two final encoder states and the bytes coded with them
+//    `BlockType::Stored`: no table, the bytes as they are
+//    `BlockType::Rle`: no table, the one byte value the whole block repeats
+//    `BlockType::HuffmanContext`: which table each previous byte selects (3 bits each), 8 tables of 256 code lengths packed in nibbles, then the bytes coded with them
+//    `BlockType::HuffmanPreset`: ID of a preset table (u32), then the bytes coded with it, version 4 only; see `Preset`
+//  index:  `BlockType::Index` (u8), one entry per block (offset u64, original size u32, block size u32, CRC-32C of the original bytes u32)
+//  footer: original size (u64), index offset (u64), block count (u32), CRC-32C of all original bytes (u32), magic
+//Version 4 is the same and is what streams that may hold `BlockType::HuffmanPreset` blocks are written as, so version 3 readers turn them down instead of calling them damaged
+//Version 2 is the same without either CRC
+namespace Lzip::Container {
+    typedef uint8_t u8;
+    typedef uint32_t u32;
+    typedef uint64_t u64;
+    using std::array, std::span, std::vector, Util::writeIntLE, Util::readIntLE;
+
+    inline constexpr u64 MIN_BLOCK_SIZE = 1048576, DEFAULT_BLOCK_SIZE = 1048576, MAX_BLOCK_SIZE = 16777216;
+    inline constexpr u64 FILE_HEADER_SIZE = 12, BLOCK_HEADER_SIZE = 9, INDEX_ENTRY_SIZE = 20, FOOTER_SIZE = 28;
+    inline constexpr u64 UNCHECKED_INDEX_ENTRY_SIZE = 16, UNCHECKED_FOOTER_SIZE = 24;
+    inline constexpr u64 HUFFMAN_TABLE_SIZE = 256;
+    //Sub-streams of a `BlockType::Huffman4` block, the last one's size is what the others leave of the payload
+    inline constexpr u64 STREAM_COUNT = 4, STREAM_JUMP_TABLE_SIZE = (STREAM_COUNT - 1) * 4;
+    //Literal/length then distance code lengths, two per byte
+    inline constexpr u64 LZ77_TABLE_SIZE = (Lz77::LITLEN_SYMBOLS + Lz77::DISTANCE_SYMBOLS + 1) / 2;
+    inline constexpr u64 ANS_TABLE_SIZE = Ans::TABLE_BYTES;
+    inline constexpr u64 CONTEXT_TABLE_SIZE = Context::TABLE_BYTES;
+    inline constexpr u64 PRESET_TABLE_SIZE = 4;
+
+    enum class BlockType : u8 {
+        Huffman = 0,
+        Lz77 = 1,
+        Huffman4 = 2,
+        Ans = 3,
+        Stored = 4,
+        Rle = 5,
+        HuffmanContext = 6,
+        HuffmanPreset = 7,
+        //Not a block, marks the start of the trailing index
+        Index = 0xFF,
+    };
+
+    struct BlockHeader {
+        BlockType type{BlockType::Huffman};
+        u32 originalSize{0}, payloadSize{0};
+    };
+
+    //`size` covers the whole block, header and table included; `checksum` stays 0 in version 2
+    struct BlockInfo {
+        u64 offset{0};
+        u32 originalSize{0}, size{0}, checksum{0};
+
+        [[nodiscard]] bool operator==(const BlockInfo&) const noexcept = default;
+    };
+
+    struct Footer {
+        u32 version{LZIP_VERSION};
+        u64 originalSize{0}, indexOffset{0};
+        u32 blockCount{0}, checksum{0};
+    };
+
+    //Versions whose blocks this build reads
+    [[nodiscard]] constexpr bool isBlockVersion(u32 version) noexcept { return version == LZIP_VERSION || version == LZIP_PRESET_VERSION || version == LZIP_UNCHECKED_VERSION; }
+    [[nodiscard]] constexpr bool hasChecksums(u32 version) noexcept { return version == LZIP_VERSION || version == LZIP_PRESET_VERSION; }
+    //What a stream is written as, `preset` being `CompressOptions::preset`
+    [[nodiscard]] constexpr u32 streamVersion(u32 preset) noexcept { return preset != 0 ? LZIP_PRESET_VERSION : LZIP_VERSION; }
+    [[nodiscard]] constexpr u64 indexEntrySize(u32 version) noexcept { return hasChecksums(version) ? INDEX_ENTRY_SIZE : UNCHECKED_INDEX_ENTRY_SIZE; }
+    [[nodiscard]] constexpr u64 footerSize(u32 version) noexcept { return hasChecksums(version) ? FOOTER_SIZE : UNCHECKED_FOOTER_SIZE; }
+
+    //Whether two lists describe the same blocks, whatever their CRCs say; tells corrupted data from a broken index
+    [[nodiscard]] inline bool sameLayout(span<const BlockInfo> first, span<const BlockInfo> second) noexcept {
+        return std::equal(first.begin(), first.end(), second.begin(), second.end(), [](const BlockInfo& a, const BlockInfo& b) { return a.offset == b.offset && a.originalSize == b.originalSize && a.size == b.size; });
+    }
+
+    //The stream CRC follows from the block CRCs, so nothing is read twice to get it
+    [[nodiscard]] inline u32 streamChecksum(span<const BlockInfo> index) noexcept {
+        u32 checksum = 0;
+        for (const BlockInfo& block : index) checksum = Checksum::combine(checksum, block.checksum, block.originalSize);
+        return checksum;
+    }
+
+    [[nodiscard]] inline bool isMagic(const u8* data) noexcept {
+        return data[0] == LZIP_MAGIC[0] && data[1] == LZIP_MAGIC[1] && data[2] == LZIP_MAGIC[2] && data[3] == LZIP_MAGIC[3];
+    }
+
+    inline void writeFileHeader(vector<u8>& result, u32 blockSize, u32 version = LZIP_VERSION) noexcept {
+        result.insert(result.end(), LZIP_MAGIC.begin(), LZIP_MAGIC.end());
+        writeIntLE(result, version);
+        writeIntLE(result, blockSize);
+    }
+
+    inline void writeBlockHeader(vector<u8>& result, const BlockHeader& header) noexcept {
+        result.push_back(static_cast<u8>(header.type));
+        writeIntLE(result, header.originalSize);
+        writeIntLE(result, header.payloadSize);
+    }
+
+    //As it appears in statistics
+    [[nodiscard]] inline const char* blockTypeName(BlockType type) noexcept {
+        switch (type) {
+            case BlockType::Huffman: return "huffman";
+            case BlockType::Lz77: return "lz77";
+            case BlockType::Huffman4: return "huffman4";
+            case BlockType::Ans: return "ans";
+            case BlockType::Stored: return "stored";
+            case BlockType::Rle: return "rle";
+            case BlockType::HuffmanContext: return "huffmanContext";
+            case BlockType::HuffmanPreset: return "huffmanPreset";
+            default: return "unknown";
+        }
+    }
+
+    [[nodiscard]] inline BlockHeader readBlockHeader(const u8* data) noexcept {
+        return {static_cast<BlockType>(data[0]), readIntLE<u32>(data + 1), readIntLE<u32>(data + 5)};
+    }
+
+    //Upper bound for a block's payload, used to reject corrupted headers before allocating for them
+    [[nodiscard]] inline u64 maxPayloadSize(u32 originalSize) noexcept {
+        //Each sub-stream pads its last byte separately
+        return ((static_cast<u64>(originalSize) * Huffman::MAX_CODE_LEN + 7) >> 3) + STREAM_COUNT;
+    }
+
+    //Largest a coded block of up to `blockSize` bytes gets while a coder writes it, for sizing buffers before any are allocated
+    [[nodiscard]] inline u64 codedBlockBytes(u64 blockSize) noexcept {
+        const u64 largestTable = std::max({HUFFMAN_TABLE_SIZE + STREAM_JUMP_TABLE_SIZE, LZ77_TABLE_SIZE, ANS_TABLE_SIZE, CONTEXT_TABLE_SIZE});
+        return BLOCK_HEADER_SIZE + largestTable + maxPayloadSize(static_cast<u32>(blockSize));
+    }
+
+    //Size of the table between a block's header and its payload
+    [[nodiscard]] inline u64 tableSize(BlockType type) noexcept {
+        switch (type) {
+            case BlockType::Huffman: return HUFFMAN_TABLE_SIZE;
+            case BlockType::Lz77: return LZ77_TABLE_SIZE;
+            case BlockType::Huffman4: return HUFFMAN_TABLE_SIZE + STREAM_JUMP_TABLE_SIZE;
+            case BlockType::Ans: return ANS_TABLE_SIZE;
+            case BlockType::HuffmanContext: return CONTEXT_TABLE_SIZE;
+            case BlockType::HuffmanPreset: return PRESET_TABLE_SIZE;
+            default: return 0;
+        }
+    }
+
+    inline void writeIndex(vector<u8>& result, span<const BlockInfo> index, u64 indexOffset, u64 originalSize) noexcept {
+        result.push_back(static_cast<u8>(BlockType::Index));
+        for (const BlockInfo& block : index) {
+            writeIntLE(result, block.offset);
+            writeIntLE(result, block.originalSize);
+            writeIntLE(result, block.size);
+            writeIntLE(result, block.checksum);
+        }
+        writeIntLE(result, originalSize);
+        writeIntLE(result, indexOffset);
+        writeIntLE(result, static_cast<u32>(index.size()));
+        writeIntLE(result, streamChecksum(index));
+        result.insert(result.end(), LZIP_MAGIC.begin(), LZIP_MAGIC.end());
+    }
+
+    //`data` holds the last `footerSize(version)` bytes of the file
+    [[nodiscard]] inline bool readFooter(const u8* data, u64 fileSize, u32 version, Footer& footer) noexcept {
+        const u64 size = footerSize(version);
+        if (!isMagic(data + size - 4)) return false;
+        footer.version = version;
+        footer.originalSize = readIntLE<u64>(data);
+        footer.indexOffset = readIntLE<u64>(data + 8);
+        footer.blockCount = readIntLE<u32>(data + 16);
+        footer.checksum = hasChecksums(version) ? readIntLE<u32>(data + 20) : 0;
+        //The index must sit exactly between the last block and the footer
+        return footer.indexOffset >= FILE_HEADER_SIZE && footer.indexOffset + 1 + footer.blockCount * indexEntrySize(version) + size == fileSize;
+    }
+
+    //`data` starts at `footer.indexOffset`, blocks must be contiguous, in order and add up to the original size, and their CRCs to the stream's
+    [[nodiscard]] inline bool readIndex(span<const u8> data, const Footer& footer, u32 maxBlockSize, vector<BlockInfo>& index) noexcept {
+        index.clear();
+        const u64 entrySize = indexEntrySize(footer.version);
+        if (data.size() < 1 + footer.blockCount * entrySize || data[0] != static_cast<u8>(BlockType::Index)) return false;
+        index.reserve(footer.blockCount);
+        u64 expectedOffset = FILE_HEADER_SIZE, originalSize = 0;
+        for (u32 i = 0; i < footer.blockCount; i++) {
+            const u8* entry = data.data() + 1 + i * entrySize;
+            const BlockInfo block{readIntLE<u64>(entry), readIntLE<u32>(entry + 8), readIntLE<u32>(entry + 12), hasChecksums(footer.version) ? readIntLE<u32>(entry + 16) : 0};
+            if (block.offset != expectedOffset || block.size < BLOCK_HEADER_SIZE || block.originalSize == 0 || block.originalSize > maxBlockSize) return false;
+            expectedOffset += block.size;
+            originalSize += block.originalSize;
+            index.push_back(block);
+        }
+        return expectedOffset == footer.indexOffset && originalSize == footer.originalSize && (!hasChecksums(footer.version) || streamChecksum(index) == footer.checksum);
+    }
+}
\ No newline at end of file
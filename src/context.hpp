@@ -0,0 +1,198 @@
+﻿#pragma once
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+#include "huffman.hpp"
+
+//Order-1 Huffman coding for `BlockType::HuffmanContext` blocks:
+//  each byte is coded with one of up to `MAX_TABLES` tables, chosen by the byte before it through a 256-entry context map
+//  contexts whose next bytes are distributed alike share a table, so structured data gets most of an order-1 model for the price of a few tables
+namespace Lzip::Context {
+    typedef uint8_t u8;
+    typedef uint16_t u16;
+    typedef uint32_t u32;
+    typedef uint64_t u64;
+    using std::array, std::span, std::vector, Huffman::HuffmanCode, Huffman::DecodeEntry, Huffman::DecodeTable;
+
+    inline constexpr u32 MAX_TABLES = 8, MAP_BITS = 3;
+    //Short enough for one nibble per code length, and for three codes per refilled bit buffer
+    inline constexpr u16 MAX_CODE_LEN = 15;
+    inline constexpr u32 MAP_BYTES = 256 * MAP_BITS / 8, CODE_TABLE_BYTES = 256 / 2, TABLE_BYTES = MAP_BYTES + MAX_TABLES * CODE_TABLE_BYTES;
+    //Rounds of reassigning contexts to their cheapest table, assignments rarely move after a few
+    inline constexpr u32 CLUSTER_ROUNDS = 6;
+
+    typedef array<u8, 256> ContextMap;
+
+    //Tables and map for one block; tables past `tableCount` are empty and no context maps to them
+    struct Model {
+        ContextMap map{};
+        array<array<HuffmanCode, 256>, MAX_TABLES> codes{};
+        u32 tableCount{0};
+        u64 payloadBits{0};
+    };
+
+    //`counts[previous * 256 + byte]`, a block's first byte counts as following a 0
+    inline void countPairs(span<const u8> input, vector<u32>& counts) noexcept {
+        counts.assign(256 * 256, 0);
+        u32 previous = 0;
+        for (const u8 byte : input) {
+            counts[previous << 8 | byte]++;
+            previous = byte;
+        }
+    }
+
+    //Estimated bits per byte under a table built from `frequencies`; bytes it hasn't seen yet count as rarer than any it has
+    inline void estimateCosts(const array<u64, 256>& frequencies, array<float, 256>& costs) noexcept {
+        u64 total = 0;
+        for (const u64 frequency : frequencies) total += frequency;
+        const float totalBits = std::log2(static_cast<float>(total) + 1.0f);
+        for (u32 i = 0; i < 256; i++) costs[i] = totalBits - std::log2(static_cast<float>(frequencies[i]) + 0.5f);
+    }
+
+    //Groups the 256 contexts into at most `MAX_TABLES` clusters with similar next-byte distributions, returns how many are used
+    //Seeds are picked farthest-first, then contexts move to whichever cluster codes them cheapest until nothing changes (k-means on code cost)
+    [[nodiscard]] inline u32 clusterContexts(const vector<u32>& counts, ContextMap& map) noexcept {
+        array<u64, 256> contextTotals{};
+        vector<u16> active;
+        for (u32 context = 0; context < 256; context++) {
+            for (u32 byte = 0; byte < 256; byte++) contextTotals[context] += counts[context << 8 | byte];
+            if (contextTotals[context] > 0) active.push_back(static_cast<u16>(context));
+        }
+        map.fill(0);
+        if (active.size() <= MAX_TABLES) {
+            for (u32 i = 0; i < active.size(); i++) map[active[i]] = static_cast<u8>(i);
+            return static_cast<u32>(active.size());
+        }
+        const auto contextCost = [&counts](u32 context, const array<float, 256>& costs) {
+            float bits = 0;
+            for (u32 byte = 0; byte < 256; byte++) bits += static_cast<float>(counts[context << 8 | byte]) * costs[byte];
+            return bits;
+        };
+        array<array<float, 256>, MAX_TABLES> clusterCosts;
+        array<float, 256> ownCosts, bestCosts;
+        //What each context would cost with a table of its own, the floor any shared table is measured against
+        array<float, 256> ownBits{};
+        for (const u16 context : active) {
+            array<u64, 256> frequencies;
+            for (u32 byte = 0; byte < 256; byte++) frequencies[byte] = counts[context << 8 | byte];
+            estimateCosts(frequencies, ownCosts);
+            ownBits[context] = contextCost(context, ownCosts);
+        }
+        //The busiest context seeds the first cluster, each next seed is the context worst served by the clusters so far
+        u32 clusterCount = 0;
+        bestCosts.fill(INFINITY);
+        u16 seed = *std::max_element(active.begin(), active.end(), [&contextTotals](u16 a, u16 b) { return contextTotals[a] < contextTotals[b]; });
+        while (true) {
+            array<u64, 256> frequencies;
+            for (u32 byte = 0; byte < 256; byte++) frequencies[byte] = counts[seed << 8 | byte];
+            estimateCosts(frequencies, clusterCosts[clusterCount]);
+            float worstLoss = 0;
+            for (const u16 context : active) {
+                const float bits = contextCost(context, clusterCosts[clusterCount]);
+                if (bits < bestCosts[context]) {
+                    bestCosts[context] = bits;
+                    map[context] = static_cast<u8>(clusterCount);
+                }
+                if (bestCosts[context] - ownBits[context] > worstLoss) {
+                    worstLoss = bestCosts[context] - ownBits[context];
+                    seed = context;
+                }
+            }
+            clusterCount++;
+            //Every context is already served about as well as by its own table
+            if (clusterCount == MAX_TABLES || worstLoss < 1.0f) break;
+        }
+        for (u32 round = 0; round < CLUSTER_ROUNDS; round++) {
+            array<array<u64, 256>, MAX_TABLES> clusterFrequencies{};
+            for (const u16 context : active) for (u32 byte = 0; byte < 256; byte++) clusterFrequencies[map[context]][byte] += counts[context << 8 | byte];
+            for (u32 cluster = 0; cluster < clusterCount; cluster++) estimateCosts(clusterFrequencies[cluster], clusterCosts[cluster]);
+            bool moved = false;
+            for (const u16 context : active) {
+                u8 best = map[context];
+                float bestBits = contextCost(context, clusterCosts[best]);
+                for (u32 cluster = 0; cluster < clusterCount; cluster++) {
+                    const float bits = contextCost(context, clusterCosts[cluster]);
+                    if (bits < bestBits) {
+                        bestBits = bits;
+                        best = static_cast<u8>(cluster);
+                    }
+                }
+                moved |= best != map[context];
+                map[context] = best;
+            }
+            if (!moved) break;
+        }
+        //Clusters that lost all their contexts leave gaps, tables are numbered densely
+        array<u8, MAX_TABLES> renumbered;
+        renumbered.fill(0xFF);
+        u32 tableCount = 0;
+        for (const u16 context : active) {
+            if (renumbered[map[context]] == 0xFF) renumbered[map[context]] = static_cast<u8>(tableCount++);
+            map[context] = renumbered[map[context]];
+        }
+        return tableCount;
+    }
+
+    //Clusters the contexts of `input` and builds a table per cluster, false if there's nothing to code; `counts` is scratch kept between blocks
+    [[nodiscard]] inline bool buildModel(span<const u8> input, Model& model, vector<u32>& counts) noexcept {
+        if (input.empty()) return false;
+        countPairs(input, counts);
+        model.tableCount = clusterContexts(counts, model.map);
+        array<array<u64, 256>, MAX_TABLES> frequencies{};
+        for (u32 context = 0; context < 256; context++) for (u32 byte = 0; byte < 256; byte++) frequencies[model.map[context]][byte] += counts[context << 8 | byte];
+        model.payloadBits = 0;
+        for (u32 table = 0; table < MAX_TABLES; table++) {
+            u16 presentedSymbolCount;
+            Huffman::getHuffmanCode(frequencies[table], model.codes[table], presentedSymbolCount, MAX_CODE_LEN);
+            for (u32 byte = 0; byte < 256; byte++) model.payloadBits += frequencies[table][byte] * model.codes[table][byte].codeLen;
+        }
+        return true;
+    }
+
+    //The context map at `MAP_BITS` per context, then every table's code lengths as nibbles, empty tables included
+    inline void serialize(const Model& model, vector<u8>& data) noexcept {
+        u32 bitBuffer = 0, bitCount = 0;
+        for (const u8 table : model.map) {
+            bitBuffer = bitBuffer << MAP_BITS | table;
+            bitCount += MAP_BITS;
+            for (; bitCount >= 8; bitCount -= 8) data.push_back(static_cast<u8>(bitBuffer >> (bitCount - 8)));
+        }
+        for (const array<HuffmanCode, 256>& codes : model.codes) for (u32 i = 0; i < 256; i += 2) data.push_back(static_cast<u8>(codes[i].codeLen << 4 | codes[i + 1].codeLen));
+    }
+
+    inline void deserialize(span<const u8> table, ContextMap& map, array<array<u8, 256>, MAX_TABLES>& lengths) noexcept {
+        u32 bitBuffer = 0, bitCount = 0, position = 0;
+        for (u8& context : map) {
+            for (; bitCount < MAP_BITS; bitCount += 8) bitBuffer = bitBuffer << 8 | table[position++];
+            context = static_cast<u8>((bitBuffer >> (bitCount - MAP_BITS)) & ((1u << MAP_BITS) - 1));
+            bitCount -= MAP_BITS;
+        }
+        for (array<u8, 256>& codeLens : lengths) for (u32 i = 0; i < 256; i += 2) {
+            codeLens[i] = table[position] >> 4;
+            codeLens[i + 1] = table[position++] & 0xF;
+        }
+    }
+
+    //Builds every table, then pairs up short codes like `Huffman::buildDecodeTable` does, except that the second byte is looked up in the table the first one selects
+    //`singles` is scratch for the unpaired primaries
+    [[nodiscard]] inline bool buildDecodeTables(const ContextMap& map, const array<array<u8, 256>, MAX_TABLES>& lengths, array<DecodeTable, MAX_TABLES>& tables, array<array<DecodeEntry, Huffman::DECODE_TABLE_SIZE>, MAX_TABLES>& singles) noexcept {
+        for (u32 i = 0; i < MAX_TABLES; i++) {
+            array<HuffmanCode, 256> codes;
+            if (!Huffman::getCanonicalCode(lengths[i], codes, MAX_CODE_LEN) || !Huffman::buildDecodeTable(codes, tables[i], false)) return false;
+        }
+        constexpr u32 TABLE_BITS = Huffman::DECODE_TABLE_BITS, TABLE_SIZE = Huffman::DECODE_TABLE_SIZE;
+        for (u32 i = 0; i < MAX_TABLES; i++) singles[i] = tables[i].primary;
+        for (u32 table = 0; table < MAX_TABLES; table++) for (u32 i = 0; i < TABLE_SIZE; i++) {
+            const DecodeEntry first = singles[table][i];
+            if (first.count != 1 || first.length >= TABLE_BITS) continue;
+            const DecodeEntry second = singles[map[first.payload]][(i << first.length) & (TABLE_SIZE - 1)];
+            if (second.count != 1 || second.length > TABLE_BITS - first.length) continue;
+            tables[table].primary[i] = {static_cast<u32>(first.payload | (second.payload << 8)), first.length, 2, static_cast<u32>(first.length + second.length)};
+        }
+        return true;
+    }
+}
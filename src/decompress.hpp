@@ -1,115 +1,476 @@
 ﻿#pragma once
+#include <algorithm>
 #include <array>
-#include <chrono>
-#include <filesystem>
-#include <iostream>
+#include <bit>
+#include <cstring>
+#include <memory>
 #include <span>
-#include <string>
 #include <vector>
 
+#include "ans.hpp"
+#include "container.hpp"
+#include "context.hpp"
 #include "huffman.hpp"
-#include "meta.hpp"
+#include "lz77.hpp"
+#include "preset.hpp"
+#include "stats.hpp"
 #include "utils.hpp"
 
 namespace Lzip {
     typedef uint8_t u8;
     typedef uint16_t u16;
+    typedef uint32_t u32;
     typedef uint64_t u64;
-    using std::array, std::cout, std::cin, std::fixed, std::setprecision, std::to_string, std::string, std::vector, std::span, std::filesystem::path, std::filesystem::exists, std::filesystem::is_regular_file, std::chrono::steady_clock, std::chrono::duration_cast, std::chrono::milliseconds, Util::FileReader, Util::FileWriter, Util::normalize, Util::IO_CHUNK_SIZE, Util::printCodes, Huffman::deserialize, Huffman::IndexedNodeR, Huffman::HuffmanCode, Huffman::getCodeMap;
-    inline void decompress(span<const u8> data, const vector<IndexedNodeR>& tree, vector<u8>& result, u64& writtenBytes, u16& currentNode, u64 maxBytes) noexcept;
-
-    inline constexpr const char* INVALID_LZIP_FILE_ERROR = "输入文件不是有效的 Lzip 文件。";
-    [[nodiscard]] inline bool decompressFile(const string& inputFile, const string& outputFile) noexcept {
-        steady_clock::time_point startTime = steady_clock::now();
-        path inputPath(inputFile);
-        if (!normalize(inputPath)) {
-            Util::setError(string("输入文件路径有误：") + inputFile);
-            return false;
+    using std::array, std::vector, std::span, Util::IO_CHUNK_SIZE, Huffman::HuffmanCode, Huffman::DecodeEntry, Huffman::DecodeTable, Huffman::getCanonicalCode, Huffman::buildDecodeTable, Huffman::DECODE_TABLE_BITS, Container::BlockType, Container::BlockHeader;
+
+    //Bits left over between input chunks, kept left-aligned in `bitBuffer`
+    struct DecoderState {
+        u64 bitBuffer{0};
+        u32 bitCount{0};
+    };
+
+    //Tables block decoding rebuilds for every block; reused so their second levels keep their capacity
+    struct DecodeWorkspace {
+        DecodeTable huffman, litlen, distance;
+        Ans::DecodeTable ans;
+        array<DecodeTable, Context::MAX_TABLES> context;
+        array<array<DecodeEntry, Huffman::DECODE_TABLE_SIZE>, Context::MAX_TABLES> singles;
+
+        //About what a workspace grows to: second levels take at most 16 entries per symbol while codes stay within 15 bits, which only a plain Huffman table can exceed
+        [[nodiscard]] static constexpr u64 bound() noexcept {
+            constexpr u64 SECONDARY = u64(1) << (15 - DECODE_TABLE_BITS);
+            return sizeof(DecodeWorkspace) + ((1 + Context::MAX_TABLES) * 256 + Lz77::LITLEN_SYMBOLS + Lz77::DISTANCE_SYMBOLS) * SECONDARY * sizeof(DecodeEntry);
         }
-        path outputPath;
-        if (outputFile.empty()) {
-            outputPath = inputFile;
-            const string fileName = outputPath.filename().string();
-            if (fileName.find(".lzip") == fileName.size() - 5) outputPath = outputPath.parent_path() / fileName.substr(0, fileName.size() - 5);
+    };
+
+    //One per thread, on the heap since it's too big for thread-local storage to hold in place
+    [[nodiscard]] inline DecodeWorkspace& decodeWorkspace() noexcept {
+        thread_local std::unique_ptr<DecodeWorkspace> workspace = std::make_unique<DecodeWorkspace>();
+        return *workspace;
+    }
+
+    [[nodiscard]] inline bool decompress(span<const u8> data, const DecodeTable& table, vector<u8>& result, u64& writtenBytes, DecoderState& state, u64 maxBytes) noexcept;
+    [[nodiscard]] inline bool decompressBlock(span<const u8> block, span<u8> result, Util::CodingStats* stats = nullptr) noexcept;
+    [[nodiscard]] inline u32 unknownPreset(span<const u8> block) noexcept;
+
+    //Looks up the next entry, the caller checks it against the buffered bit count
+    [[nodiscard]] inline DecodeEntry peekEntry(const DecodeTable& table, u64 bitBuffer) noexcept {
+        const DecodeEntry entry = table.primary[bitBuffer >> (64 - DECODE_TABLE_BITS)];
+        if (entry.count != 0) [[likely]] return entry;
+        return table.secondary[entry.payload + ((bitBuffer << DECODE_TABLE_BITS) >> (64 - entry.length))];
+    }
+
+    //Decodes at most `maxSymbols` bytes into `out` with a table whose codes are at most `MAX_LEN` bits long, stops early once the buffered bits can't hold the next code
+    template <u32 MAX_LEN>
+    [[nodiscard]] inline u64 decodeKernel(span<const u8> data, u64& position, const DecodeTable& table, DecoderState& state, u8* out, u64 maxSymbols) noexcept {
+        //A probe takes at most one code, or a pair that fits the primary index
+        constexpr u32 PROBES = 56 / std::max<u32>(MAX_LEN, DECODE_TABLE_BITS);
+        u64 bitBuffer = state.bitBuffer, written = 0;
+        u32 bitCount = state.bitCount;
+        const auto probe = [&table](u64 bits) _LZIP_FORCE_INLINE {
+            if constexpr (MAX_LEN <= DECODE_TABLE_BITS) return table.primary[bits >> (64 - DECODE_TABLE_BITS)];
+            else return peekEntry(table, bits);
+        };
+        //Fast path: a refill leaves at least 56 bits, enough for `PROBES` probes, and `out` has room for two bytes from each
+        for (bool stopped = false; !stopped && position + 8 <= data.size() && written + 2 * PROBES <= maxSymbols;) {
+            //Bytes past `bitCount` may already be loaded, they are ORed again with the same value
+            bitBuffer |= Util::loadBE64(data.data() + position) >> bitCount;
+            position += (63 - bitCount) >> 3;
+            bitCount |= 56;
+            for (u32 i = 0; i < PROBES; i++) {
+                const DecodeEntry entry = probe(bitBuffer);
+                if (entry.length > bitCount) [[unlikely]] {
+                    stopped = true;
+                    break;
+                }
+                out[written] = static_cast<u8>(entry.payload);
+                out[written + 1] = static_cast<u8>(entry.payload >> 8);
+                written += entry.count;
+                bitBuffer <<= entry.length;
+                bitCount -= entry.length;
+            }
         }
-        else outputPath = outputFile;
-        if (!normalize(outputPath)) {
-            Util::setError(string("输出文件路径有误：") + outputFile);
-            return false;
+        //Topped up below 64 bits, so a stop on an invalid code still leaves a state the fast path can shift by
+        while (written < maxSymbols) {
+            while (bitCount < 56 && position < data.size()) {
+                bitBuffer |= static_cast<u64>(data[position++]) << (56 - bitCount);
+                bitCount += 8;
+            }
+            DecodeEntry entry = peekEntry(table, bitBuffer);
+            if (entry.length > bitCount) [[unlikely]] {
+                //The second code of a pair may run into the stream's padding
+                if (entry.count != 2 || entry.firstLength > bitCount) break;
+                entry.count = 1;
+                entry.length = entry.firstLength;
+            }
+            u32 consumed = entry.length;
+            out[written++] = static_cast<u8>(entry.payload);
+            if (entry.count == 2) {
+                if (written < maxSymbols) [[likely]] out[written++] = static_cast<u8>(entry.payload >> 8);
+                else consumed = entry.firstLength;
+            }
+            bitBuffer <<= consumed;
+            bitCount -= consumed;
         }
-        if (exists(outputPath) && is_regular_file(outputPath)) {
-            cout << "输出文件 \"" << STR(outputPath) << "\" 已存在，是否覆盖？(y/n)：";
-            string input;
-            cin >> input;
-            if (input != "y" && input != "Y") {
-                cout << "操作已取消。\n";
-                return true;
+        state.bitBuffer = bitCount == 0 ? 0 : bitBuffer & (~0ull << (64 - bitCount));
+        state.bitCount = bitCount;
+        return written;
+    }
+
+    typedef u64 (*DecodeKernel)(span<const u8>, u64&, const DecodeTable&, DecoderState&, u8*, u64) noexcept;
+    //Indexed by `Huffman::kernelIndex`; codes of up to 8 bits probe the same 11-bit index as longer ones, so they share a kernel
+    inline constexpr array<DecodeKernel, Huffman::KERNEL_COUNT> DECODE_KERNELS{decodeKernel<DECODE_TABLE_BITS>, decodeKernel<DECODE_TABLE_BITS>, decodeKernel<Huffman::KERNEL_CODE_LENS[2]>, decodeKernel<Huffman::KERNEL_CODE_LENS[3]>};
+
+    //Decodes at most `maxSymbols` bytes into `out` with the kernel for the table's longest code
+    [[nodiscard]] inline u64 decodeSymbols(span<const u8> data, u64& position, const DecodeTable& table, DecoderState& state, u8* out, u64 maxSymbols) noexcept {
+        return DECODE_KERNELS[Huffman::kernelIndex(table.maxCodeLen)](data, position, table, state, out, maxSymbols);
+    }
+
+    //Where one sub-stream of a `BlockType::Huffman4` block is, both in the payload and in the output
+    struct SubStream {
+        span<const u8> data;
+        u64 position{0};
+        DecoderState state;
+        u8* out{nullptr};
+        u64 size{0}, written{0};
+    };
+
+    //Decodes the 4 sub-streams side by side, so a core has four independent chains of table lookups in flight instead of one
+    [[nodiscard]] inline bool decodeStreams(span<const u8> jumpTable, span<const u8> payload, const DecodeTable& table, span<u8> out) noexcept {
+        array<SubStream, Container::STREAM_COUNT> streams;
+        const u64 segmentSize = (out.size() + Container::STREAM_COUNT - 1) / Container::STREAM_COUNT;
+        u64 payloadOffset = 0;
+        for (u32 i = 0; i < Container::STREAM_COUNT; i++) {
+            const u64 size = i + 1 < Container::STREAM_COUNT ? Util::readIntLE<u32>(jumpTable.data() + i * 4) : payload.size() - payloadOffset;
+            if (payloadOffset + size > payload.size()) return false;
+            const u64 outputOffset = std::min<u64>(out.size(), i * segmentSize);
+            streams[i].data = payload.subspan(payloadOffset, size);
+            streams[i].out = out.data() + outputOffset;
+            streams[i].size = std::min<u64>(out.size() - outputOffset, segmentSize);
+            payloadOffset += size;
+        }
+        //Hot state of one sub-stream, kept in locals so it can live in registers
+        struct Lane {
+            const u8* in;
+            u8* out;
+            u64 bitBuffer;
+            u32 bitCount;
+        };
+        const auto toLane = [](SubStream& stream) { return Lane{stream.data.data(), stream.out, 0, 0}; };
+        Lane lane0 = toLane(streams[0]), lane1 = toLane(streams[1]), lane2 = toLane(streams[2]), lane3 = toLane(streams[3]);
+        //A round reads at most 7 bytes and writes at most 4 per sub-stream, so this many rounds run without bounds checks
+        const auto safeRounds = [](const Lane& lane, const SubStream& stream) {
+            const u64 inputLeft = static_cast<u64>(stream.data.data() + stream.data.size() - lane.in), outputLeft = static_cast<u64>(stream.out + stream.size - lane.out);
+            return inputLeft < 8 ? 0 : std::min((inputLeft - 8) / 7 + 1, outputLeft / 4);
+        };
+        //Same steps as the fast path of `decodeSymbols`, for one sub-stream
+        const auto step = [&table](Lane& lane) _LZIP_FORCE_INLINE {
+            lane.bitBuffer |= Util::loadBE64(lane.in) >> lane.bitCount;
+            lane.in += (63 - lane.bitCount) >> 3;
+            lane.bitCount |= 56;
+            DecodeEntry entry = peekEntry(table, lane.bitBuffer);
+            if (entry.length > lane.bitCount) [[unlikely]] return false;
+            lane.out[0] = static_cast<u8>(entry.payload);
+            lane.out[1] = static_cast<u8>(entry.payload >> 8);
+            lane.out += entry.count;
+            lane.bitBuffer <<= entry.length;
+            lane.bitCount -= entry.length;
+            entry = peekEntry(table, lane.bitBuffer);
+            if (entry.length > lane.bitCount) [[unlikely]] return false;
+            lane.out[0] = static_cast<u8>(entry.payload);
+            lane.out[1] = static_cast<u8>(entry.payload >> 8);
+            lane.out += entry.count;
+            lane.bitBuffer <<= entry.length;
+            lane.bitCount -= entry.length;
+            return true;
+        };
+        bool valid = true;
+        while (valid) {
+            const u64 rounds = std::min({safeRounds(lane0, streams[0]), safeRounds(lane1, streams[1]), safeRounds(lane2, streams[2]), safeRounds(lane3, streams[3])});
+            if (rounds == 0) break;
+            for (u64 i = 0; i < rounds; i++) {
+                if (!step(lane0) || !step(lane1) || !step(lane2) || !step(lane3)) [[unlikely]] {
+                    valid = false;
+                    break;
+                }
             }
         }
-        FileReader reader(inputPath);
-        if (!reader.file.is_open()) {
-            Util::setError(string("无法打开输入文件：") + STR(inputPath));
-            return false;
+        const auto fromLane = [](const Lane& lane, SubStream& stream) {
+            stream.position = static_cast<u64>(lane.in - stream.data.data());
+            stream.written = static_cast<u64>(lane.out - stream.out);
+            stream.state = {lane.bitBuffer, lane.bitCount};
+        };
+        fromLane(lane0, streams[0]);
+        fromLane(lane1, streams[1]);
+        fromLane(lane2, streams[2]);
+        fromLane(lane3, streams[3]);
+        for (SubStream& stream : streams) {
+            //The fast path may have loaded bits past `bitCount`, `decodeSymbols` expects them cleared
+            stream.state.bitBuffer = stream.state.bitCount == 0 ? 0 : stream.state.bitBuffer & (~0ull << (64 - stream.state.bitCount));
+            const u64 remaining = stream.size - stream.written;
+            if (decodeSymbols(stream.data, stream.position, table, stream.state, stream.out + stream.written, remaining) != remaining) return false;
         }
-        FileWriter writer(outputPath);
-        if (!writer.file.is_open()) {
-            Util::setError(string("无法打开输出文件：") + STR(outputPath));
-            return false;
+        return true;
+    }
+
+    //Fills all of `out` from one tANS payload: every state is a valid table entry, so the loop has no branch on the data besides its bounds
+    [[nodiscard]] inline bool decodeAns(span<const u8> data, const Ans::DecodeTable& table, span<u8> out) noexcept {
+        u64 bitBuffer = 0, position = 0, written = 0;
+        u32 bitCount = 0;
+        const auto refill = [&]() _LZIP_FORCE_INLINE {
+            if (position + 8 <= data.size()) [[likely]] {
+                bitBuffer |= Util::loadBE64(data.data() + position) >> bitCount;
+                position += (63 - bitCount) >> 3;
+                bitCount |= 56;
+                return;
+            }
+            while (bitCount <= 56 && position < data.size()) {
+                bitBuffer |= static_cast<u64>(data[position++]) << (56 - bitCount);
+                bitCount += 8;
+            }
+        };
+        //Shifted in two steps so that taking 0 bits is defined
+        const auto takeBits = [&](u32 count) _LZIP_FORCE_INLINE {
+            const u32 value = static_cast<u32>(bitBuffer >> (63 - count) >> 1);
+            bitBuffer <<= count;
+            bitCount -= count;
+            return value;
+        };
+        refill();
+        //Zero padding up to the 1 bit, then the initial states
+        if (bitCount < 8 || (bitBuffer >> 56) == 0) return false;
+        takeBits(static_cast<u32>(std::countl_zero(bitBuffer)) + 1);
+        array<u32, Ans::STATE_COUNT> states;
+        for (u32& state : states) {
+            refill();
+            if (bitCount < Ans::TABLE_LOG) return false;
+            state = takeBits(Ans::TABLE_LOG);
         }
-        if (reader.fileSize < 272) {
-            Util::setError(INVALID_LZIP_FILE_ERROR);
-            return false;
+        const auto decode = [&](u32& state) _LZIP_FORCE_INLINE {
+            const Ans::DecodeEntry entry = table.entries[state];
+            out[written++] = entry.symbol;
+            state = entry.baseState + takeBits(entry.bits);
+        };
+        u32 state0 = states[0], state1 = states[1];
+        //A refill leaves at least 56 bits, enough for four entries of up to `TABLE_LOG` bits
+        while (position + 8 <= data.size() && written + 4 <= out.size()) {
+            refill();
+            decode(state0);
+            decode(state1);
+            decode(state0);
+            decode(state1);
         }
-        //Check magic number
-        array<u8, 4> magic{};
-        reader.file.read(reinterpret_cast<char*>(magic.data()), 4);
-        if (magic[0] != LZIP_MAGIC[0] || magic[1] != LZIP_MAGIC[1] || magic[2] != LZIP_MAGIC[2] || magic[3] != LZIP_MAGIC[3]) {
-            Util::setError(INVALID_LZIP_FILE_ERROR);
-            return false;
+        while (written < out.size()) {
+            refill();
+            u32& state = (written & 1) ? state1 : state0;
+            if (table.entries[state].bits > bitCount) return false;
+            decode(state);
         }
-        //Skip version
-        reader.file.read(reinterpret_cast<char*>(magic.data()), 4);
-        //Read size
-        array<u8, 8> sizeBuffer{};
-        reader.file.read(reinterpret_cast<char*>(sizeBuffer.data()), 8);
-        const u64 originalSize = Util::readIntLE<u64>(sizeBuffer.data());
-        //Read code length table
-        static array<u8, 256> codeLens{};
-        codeLens.fill(0);
-        reader.file.read(reinterpret_cast<char*>(codeLens.data()), 256);
-        //Deserialize Huffman tree
-        vector<IndexedNodeR> huffmanTree;
-        deserialize(codeLens, huffmanTree);
-        static array<HuffmanCode, 256> codeMap;
-        codeMap.fill({});
-        getCodeMap(huffmanTree, codeMap);
-        printCodes(codeMap);
-        vector<u8> inputData, outputData;
-        u64 length = reader.nextChunk(inputData, IO_CHUNK_SIZE), ax = 0, writtenBytes = 0;
-        u16 currentNode = 0;
-        while (true) {
-            if (length == 0) break;
-            if ((ax & 63) == 0) cout << "正在解压区块 #" + to_string(ax) << '\n';
-            decompress(inputData, huffmanTree, outputData, writtenBytes, currentNode, originalSize);
-            writer.writeChunk(outputData);
-            outputData.clear();
-            inputData.clear();
-            length = reader.nextChunk(inputData, IO_CHUNK_SIZE);
-            ax++;
+        //The encoder's first bits are the payload's last, so a valid payload is used up exactly
+        return position == data.size() && bitCount == 0;
+    }
+
+    //Each lookup uses the table the last byte decoded selects, and yields one or two bytes like `decodeSymbols`
+    [[nodiscard]] inline bool decodeContext(span<const u8> data, const array<const DecodeTable*, 256>& tables, span<u8> out) noexcept {
+        u64 bitBuffer = 0, position = 0, written = 0;
+        u32 bitCount = 0, previous = 0;
+        //A refill leaves at least 56 bits, enough for three entries of up to `Context::MAX_CODE_LEN` bits, and `out` has room for six bytes
+        while (position + 8 <= data.size() && written + 6 <= out.size()) {
+            bitBuffer |= Util::loadBE64(data.data() + position) >> bitCount;
+            position += (63 - bitCount) >> 3;
+            bitCount |= 56;
+            for (u32 i = 0; i < 3; i++) {
+                const DecodeEntry entry = peekEntry(*tables[previous], bitBuffer);
+                if (entry.length > bitCount) [[unlikely]] return false;
+                out[written] = static_cast<u8>(entry.payload);
+                out[written + 1] = static_cast<u8>(entry.payload >> 8);
+                written += entry.count;
+                //The second byte of a pair, or the only one
+                previous = (entry.payload >> ((entry.count - 1) << 3)) & 0xFF;
+                bitBuffer <<= entry.length;
+                bitCount -= entry.length;
+            }
+        }
+        while (written < out.size()) {
+            while (bitCount <= 56 && position < data.size()) {
+                bitBuffer |= static_cast<u64>(data[position++]) << (56 - bitCount);
+                bitCount += 8;
+            }
+            DecodeEntry entry = peekEntry(*tables[previous], bitBuffer);
+            //The second code of a pair may run into the padding, or past the last byte
+            if (entry.count == 2 && (entry.length > bitCount || written + 1 == out.size())) {
+                entry.count = 1;
+                entry.length = entry.firstLength;
+            }
+            if (entry.length > bitCount) return false;
+            out[written++] = static_cast<u8>(entry.payload);
+            if (entry.count == 2) out[written++] = static_cast<u8>(entry.payload >> 8);
+            previous = (entry.payload >> ((entry.count - 1) << 3)) & 0xFF;
+            bitBuffer <<= entry.length;
+            bitCount -= entry.length;
+        }
+        //Only the last byte's padding may be left
+        return position == data.size() && bitCount < 8;
+    }
+
+    //Fills all of `out` from one LZ77 payload, false on any code, length or distance the data can't have produced
+    [[nodiscard]] inline bool decodeLz77(span<const u8> data, const DecodeTable& litlenTable, const DecodeTable& distanceTable, span<u8> out) noexcept {
+        u64 bitBuffer = 0, position = 0, written = 0;
+        u32 bitCount = 0;
+        const u64 size = out.size();
+        //Leaves at least 56 bits, or whatever is left at the end of the data
+        const auto refill = [&]() {
+            if (position + 8 <= data.size()) [[likely]] {
+                bitBuffer |= Util::loadBE64(data.data() + position) >> bitCount;
+                position += (63 - bitCount) >> 3;
+                bitCount |= 56;
+                return;
+            }
+            while (bitCount <= 56 && position < data.size()) {
+                bitBuffer |= static_cast<u64>(data[position++]) << (56 - bitCount);
+                bitCount += 8;
+            }
+        };
+        const auto takeBits = [&](u32 count) {
+            const u32 value = count == 0 ? 0 : static_cast<u32>(bitBuffer >> (64 - count));
+            bitBuffer <<= count;
+            bitCount -= count;
+            return value;
+        };
+        while (written < size) {
+            refill();
+            const DecodeEntry symbol = peekEntry(litlenTable, bitBuffer);
+            if (symbol.length > bitCount) [[unlikely]] return false;
+            takeBits(symbol.length);
+            if (symbol.payload < Lz77::LITERAL_SYMBOLS) {
+                out[written++] = static_cast<u8>(symbol.payload);
+                continue;
+            }
+            //Length and distance codes plus their extra bits fit in two refills
+            const u32 lengthCode = symbol.payload - Lz77::LITERAL_SYMBOLS;
+            if (lengthCode >= Lz77::LENGTH_SYMBOLS || Lz77::LENGTH_EXTRA[lengthCode] > bitCount) [[unlikely]] return false;
+            const u32 length = Lz77::LENGTH_BASE[lengthCode] + takeBits(Lz77::LENGTH_EXTRA[lengthCode]);
+            refill();
+            const DecodeEntry distanceSymbol = peekEntry(distanceTable, bitBuffer);
+            if (distanceSymbol.length > bitCount) [[unlikely]] return false;
+            takeBits(distanceSymbol.length);
+            const u32 distanceCode = distanceSymbol.payload;
+            if (distanceCode >= Lz77::DISTANCE_SYMBOLS || Lz77::distanceExtra(distanceCode) > bitCount) [[unlikely]] return false;
+            const u64 distance = Lz77::distanceBase(distanceCode) + takeBits(Lz77::distanceExtra(distanceCode));
+            if (distance > written || length > size - written) [[unlikely]] return false;
+            u8* target = out.data() + written;
+            const u8* source = target - distance;
+            //Whole words are safe once the source is at least a word behind, the last one may overshoot by up to 7 bytes
+            if (distance >= 8 && written + length + 8 <= size) for (u32 i = 0; i < length; i += 8) memcpy(target + i, source + i, 8);
+            else for (u32 i = 0; i < length; i++) target[i] = source[i];
+            written += length;
+        }
+        return true;
+    }
+
+    //False once decoding stops short with input left, which only an invalid code does; a code cut off at the end of `data` waits in `state` for the next call
+    [[nodiscard]] inline bool decompress(span<const u8> data, const DecodeTable& table, vector<u8>& result, u64& writtenBytes, DecoderState& state, u64 maxBytes) noexcept {
+        u64 position = 0;
+        while (writtenBytes < maxBytes) {
+            const u64 slice = std::min(maxBytes - writtenBytes, IO_CHUNK_SIZE), oldSize = result.size();
+            result.resize(oldSize + slice);
+            const u64 decoded = decodeSymbols(data, position, table, state, result.data() + oldSize, slice);
+            result.resize(oldSize + decoded);
+            writtenBytes += decoded;
+            if (decoded < slice) return position == data.size();
         }
-        cout << "解压完成，耗时 " << duration_cast<milliseconds>(steady_clock::now() - startTime).count() << " 毫秒\n输出文件：" << STR(outputPath) << '\n';
         return true;
     }
 
-    inline void decompress(span<const u8> data, const vector<IndexedNodeR>& tree, vector<u8>& result, u64& writtenBytes, u16& currentNode, u64 maxBytes) noexcept {
-        for (u64 i = 0; i < data.size() * 8; i++) {
-            currentNode = data[i >> 3] & (1 << (7 - (i & 7))) ? tree[currentNode].right : tree[currentNode].left;
-            if (tree[currentNode].isLeaf) {
-                result.push_back(tree[currentNode].byte);
-                writtenBytes++;
-                if (writtenBytes == maxBytes) return;
-                currentNode = 0;
+    //ID of the preset table a `BlockType::HuffmanPreset` block names when this process hasn't added it, 0 for any other block; tells why `decompressBlock` turned a block down
+    [[nodiscard]] inline u32 unknownPreset(span<const u8> block) noexcept {
+        if (block.size() < Container::BLOCK_HEADER_SIZE + Container::PRESET_TABLE_SIZE || static_cast<BlockType>(block[0]) != BlockType::HuffmanPreset) return 0;
+        const u32 id = Util::readIntLE<u32>(block.data() + Container::BLOCK_HEADER_SIZE);
+        return Preset::find(id) ? 0 : id;
+    }
+
+    //`block` spans the whole block, `result` must be exactly its original size
+    [[nodiscard]] inline bool decompressBlock(span<const u8> block, span<u8> result, Util::CodingStats* stats) noexcept {
+        Util::StageClock clock;
+        const auto tableBuilt = [stats, &clock] { if (stats) stats->tableTime = clock.lap(); };
+        if (block.size() < Container::BLOCK_HEADER_SIZE) return false;
+        const BlockHeader header = Container::readBlockHeader(block.data());
+        const u64 tableSize = Container::tableSize(header.type);
+        if (header.originalSize != result.size() || block.size() != Container::BLOCK_HEADER_SIZE + tableSize + header.payloadSize) return false;
+        const span<const u8> table = block.subspan(Container::BLOCK_HEADER_SIZE, tableSize), payload = block.subspan(Container::BLOCK_HEADER_SIZE + tableSize);
+        DecodeWorkspace& workspace = decodeWorkspace();
+        switch (header.type) {
+            case BlockType::Huffman: {
+                array<u8, 256> codeLens{};
+                std::copy(table.begin(), table.end(), codeLens.begin());
+                array<HuffmanCode, 256> codeMap;
+                DecodeTable& decodeTable = workspace.huffman;
+                if (!getCanonicalCode(codeLens, codeMap) || !buildDecodeTable(codeMap, decodeTable)) return false;
+                tableBuilt();
+                u64 position = 0;
+                DecoderState state;
+                return decodeSymbols(payload, position, decodeTable, state, result.data(), result.size()) == result.size();
+            }
+            case BlockType::Huffman4: {
+                array<u8, 256> codeLens{};
+                std::copy(table.begin(), table.begin() + Container::HUFFMAN_TABLE_SIZE, codeLens.begin());
+                array<HuffmanCode, 256> codeMap;
+                DecodeTable& decodeTable = workspace.huffman;
+                if (!getCanonicalCode(codeLens, codeMap) || !buildDecodeTable(codeMap, decodeTable)) return false;
+                tableBuilt();
+                return decodeStreams(table.subspan(Container::HUFFMAN_TABLE_SIZE), payload, decodeTable, result);
+            }
+            case BlockType::HuffmanPreset: {
+                //Built when the table was added, nothing is left to build per block
+                const Preset::Table* preset = Preset::find(Util::readIntLE<u32>(table.data()));
+                if (!preset) return false;
+                tableBuilt();
+                u64 position = 0;
+                DecoderState state;
+                return decodeSymbols(payload, position, preset->decodeTable, state, result.data(), result.size()) == result.size();
+            }
+            case BlockType::Ans: {
+                Ans::NormalizedCounts counts;
+                Ans::deserialize(table, counts);
+                Ans::DecodeTable& decodeTable = workspace.ans;
+                if (!Ans::buildDecodeTable(counts, decodeTable)) return false;
+                tableBuilt();
+                return decodeAns(payload, decodeTable, result);
+            }
+            case BlockType::HuffmanContext: {
+                Context::ContextMap map;
+                array<array<u8, 256>, Context::MAX_TABLES> codeLens;
+                Context::deserialize(table, map, codeLens);
+                array<DecodeTable, Context::MAX_TABLES>& decodeTables = workspace.context;
+                if (!Context::buildDecodeTables(map, codeLens, decodeTables, workspace.singles)) return false;
+                array<const DecodeTable*, 256> contextTables;
+                for (u32 context = 0; context < 256; context++) contextTables[context] = &decodeTables[map[context]];
+                tableBuilt();
+                return decodeContext(payload, contextTables, result);
+            }
+            case BlockType::Stored: {
+                if (payload.size() != result.size()) return false;
+                std::copy(payload.begin(), payload.end(), result.begin());
+                return true;
+            }
+            case BlockType::Rle: {
+                if (payload.size() != 1) return false;
+                std::memset(result.data(), payload[0], result.size());
+                return true;
+            }
+            case BlockType::Lz77: {
+                array<u8, Lz77::LITLEN_SYMBOLS> litlenLengths{};
+                array<u8, Lz77::DISTANCE_SYMBOLS> distanceLengths{};
+                Lz77::deserialize(table, litlenLengths, distanceLengths);
+                array<HuffmanCode, Lz77::LITLEN_SYMBOLS> litlenCodes;
+                array<HuffmanCode, Lz77::DISTANCE_SYMBOLS> distanceCodes;
+                DecodeTable &litlenTable = workspace.litlen, &distanceTable = workspace.distance;
+                if (!getCanonicalCode(litlenLengths, litlenCodes, Lz77::MAX_CODE_LEN) || !getCanonicalCode(distanceLengths, distanceCodes, Lz77::MAX_CODE_LEN) ||
+                    !buildDecodeTable(litlenCodes, litlenTable, false) || !buildDecodeTable(distanceCodes, distanceTable, false)) return false;
+                tableBuilt();
+                return decodeLz77(payload, litlenTable, distanceTable, result);
             }
+            default: return false;
         }
     }
 }
\ No newline at end of file
@@ -0,0 +1,1067 @@
+﻿#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <iomanip>
+#include <memory>
+#include <span>
+#include <string>
+#include <vector>
+
+#include "compress.hpp"
+#include "container.hpp"
+#include "decompress.hpp"
+#include "lzip.hpp"
+#include "meta.hpp"
+#include "pipeline.hpp"
+#include "preset.hpp"
+#include "stats.hpp"
+#include "threadpool.hpp"
+#include "utils.hpp"
+
+//The file drivers: paths, overwrite checks, and the pipeline that feeds blocks between the files and the codecs
+namespace Lzip {
+    using std::array, std::fixed, std::setprecision, std::string, std::vector, std::span, std::shared_ptr, std::unique_ptr, std::error_code, std::filesystem::path, std::filesystem::exists, std::filesystem::file_size, std::filesystem::is_directory, std::filesystem::recursive_directory_iterator, std::filesystem::remove, std::chrono::steady_clock, std::chrono::duration_cast, std::chrono::milliseconds, Util::FileReader, Util::FileWriter, Util::PositionalWriter, Util::normalize, Util::IO_CHUNK_SIZE, Util::printCodes, Util::ThreadPool, Huffman::HuffmanCode, Huffman::DecodeTable, Huffman::getCanonicalCode, Huffman::buildDecodeTable, Container::BlockType, Container::BlockHeader, Container::BlockInfo, Container::Footer;
+
+    namespace {
+        enum class OutputCheck : u8 {
+            Proceed,
+            //The caller declined to replace the output, which isn't an error
+            Skip,
+            Fail,
+        };
+
+        //Both name one existing file, however they are spelled or linked
+        [[nodiscard]] bool sameFile(const path& first, const path& second) noexcept {
+            if (first.empty() || second.empty() || first == Util::STDIO_PATH || second == Util::STDIO_PATH) return false;
+            error_code ec;
+            return std::filesystem::equivalent(first, second, ec);
+        }
+
+        //The output is replaced before the input is read through, so writing over the input is refused whatever `confirmOverwrite` says
+        [[nodiscard]] OutputCheck checkOutput(const path& inputPath, const path& outputPath, const OverwritePrompt& confirmOverwrite) noexcept {
+            if (sameFile(inputPath, outputPath)) {
+                Util::setError(string("输出文件与输入文件相同：") + STR(outputPath));
+                return OutputCheck::Fail;
+            }
+            if (outputPath == Util::STDIO_PATH || !exists(outputPath)) return OutputCheck::Proceed;
+            //stdin can't answer a prompt while it carries the input
+            if (!confirmOverwrite || inputPath == Util::STDIO_PATH) {
+                Util::setError(string("输出文件已存在：") + STR(outputPath));
+                return OutputCheck::Fail;
+            }
+            return confirmOverwrite(outputPath) ? OutputCheck::Proceed : OutputCheck::Skip;
+        }
+
+        constexpr const char* INVALID_LZIP_FILE_ERROR = "输入文件不是有效的 Lzip 文件。";
+        constexpr const char* CHECKSUM_ERROR = "校验和不匹配，输入文件已损坏。";
+
+        //Blocks `decompressBlock` turned down are damaged, unless they name a trained preset table nobody loaded; `missingPreset` is what `unknownPreset` found
+        [[nodiscard]] string blockError(u32 missingPreset) noexcept {
+            if (missingPreset == 0) return INVALID_LZIP_FILE_ERROR;
+            return "缺少预设表 " + Preset::formatId(missingPreset) + "，需要先加载压缩时所用的预设表文件（命令行用 --preset）。";
+        }
+
+        //The requested threads and pipeline depth, cut down until `slotBytes` per slot and `workerBytes` per thread fit `memoryLimit`; false with the error set if one of each doesn't
+        [[nodiscard]] bool planPipeline(u32 requestedThreads, u32 maxInFlight, u64 memoryLimit, u64 slotBytes, u64 workerBytes, u32& threads, u64& slotCount) noexcept {
+            threads = Util::resolveThreadCount(requestedThreads);
+            slotCount = maxInFlight > 0 ? maxInFlight : u64(threads) * 2;
+            if (Util::fitMemory(memoryLimit, slotBytes, workerBytes, threads, slotCount)) return true;
+            Util::setError("内存上限太小，至少需要 " + std::to_string((slotBytes + workerBytes + 1048575) >> 20) + " MiB。");
+            return false;
+        }
+        //The decoders below discard what they decode when given an empty `outputPath`, which is how `testFile` checks a file; `decodedBytes` is the original size they got through
+        //Version 1: one global table followed by a single bitstream, the reader sits right after the version
+        [[nodiscard]] bool decompressLegacyStream(FileReader& reader, const path& outputPath, const DecompressOptions& options, u64& decodedBytes) noexcept {
+            //Read size and code length table
+            array<u8, 8> sizeBuffer{};
+            array<u8, 256> codeLens{};
+            if (!reader.read(sizeBuffer.data(), 8) || !reader.read(codeLens.data(), 256)) {
+                Util::setError(INVALID_LZIP_FILE_ERROR);
+                return false;
+            }
+            const u64 originalSize = Util::readIntLE<u64>(sizeBuffer.data());
+            FileWriter writer(outputPath);
+            if (!outputPath.empty() && !writer.isOpen()) {
+                Util::setError(string("无法打开输出文件：") + STR(outputPath));
+                return false;
+            }
+            //Rebuild canonical codes and the lookup table
+            array<HuffmanCode, 256> codeMap;
+            DecodeTable decodeTable;
+            if (!getCanonicalCode(codeLens, codeMap) || !buildDecodeTable(codeMap, decodeTable)) {
+                Util::setError(INVALID_LZIP_FILE_ERROR);
+                return false;
+            }
+            printCodes(codeMap);
+            vector<u8> buffer, outputData;
+            span<const u8> inputData = reader.nextView(buffer, IO_CHUNK_SIZE);
+            u64 writtenBytes = 0;
+            DecoderState state;
+            Util::Progress progress{options.progress, originalSize};
+            while (!inputData.empty()) {
+                if (!decompress(inputData, decodeTable, outputData, writtenBytes, state, originalSize)) {
+                    Util::setError(INVALID_LZIP_FILE_ERROR);
+                    return false;
+                }
+                writer.writeChunk(outputData);
+                outputData.clear();
+                progress.update(writtenBytes);
+                inputData = reader.nextView(buffer, IO_CHUNK_SIZE);
+            }
+            progress.finish(writtenBytes);
+            decodedBytes = writtenBytes;
+            if (writtenBytes != originalSize) {
+                Util::setError(INVALID_LZIP_FILE_ERROR);
+                return false;
+            }
+            if (!writer.flush()) {
+                Util::setError(string("无法写入输出文件：") + STR(outputPath));
+                return false;
+            }
+            return true;
+        }
+
+        //Block versions only, the reader must sit right after the version
+        [[nodiscard]] bool readBlockIndex(FileReader& reader, u32 version, Footer& footer, vector<BlockInfo>& index) noexcept {
+            const u64 footerSize = Container::footerSize(version);
+            if (!reader.seekable || reader.fileSize < Container::FILE_HEADER_SIZE + 1 + footerSize) return false;
+            array<u8, Container::FOOTER_SIZE> buffer{};
+            if (!reader.read(buffer.data(), 4)) return false;
+            const u32 maxBlockSize = Util::readIntLE<u32>(buffer.data());
+            reader.seek(reader.fileSize - footerSize);
+            if (!reader.read(buffer.data(), footerSize) || !Container::readFooter(buffer.data(), reader.fileSize, version, footer)) return false;
+            vector<u8> indexBuffer;
+            reader.seek(footer.indexOffset);
+            return Container::readIndex(reader.nextView(indexBuffer, reader.fileSize - footerSize - footer.indexOffset), footer, maxBlockSize, index);
+        }
+
+        //Block versions: the footer locates the block index, blocks are decoded on the pool straight into the mapped output, or written to their offsets when it can't be mapped
+        //Each block is checked against its CRC by the task that decoded it, while it's still in cache
+        [[nodiscard]] bool decompressBlocks(FileReader& reader, u32 version, const path& outputPath, const DecompressOptions& options, u64& decodedBytes) noexcept {
+            Footer footer;
+            vector<BlockInfo> index;
+            if (!readBlockIndex(reader, version, footer, index)) {
+                Util::setError(INVALID_LZIP_FILE_ERROR);
+                return false;
+            }
+            const bool discard = outputPath.empty();
+            PositionalWriter writer(outputPath);
+            if (!discard && (!writer.isOpen() || !writer.resize(footer.originalSize))) {
+                Util::setError(string("无法打开输出文件：") + STR(outputPath));
+                return false;
+            }
+            const span<u8> mappedOutput = discard ? span<u8>() : writer.map(footer.originalSize);
+            //The reader thread fills the ring in index order, a slot is reused once its block has been decoded and written
+            //`input` views the mapped file, or `buffer` when reading from a stream; `output` is only needed without a mapped output
+            struct Slot {
+                span<const u8> input;
+                vector<u8> buffer, output;
+                u64 outputOffset{0};
+                u32 originalSize{0}, checksum{0};
+                Util::CodingStats coding;
+                bool succeeded{false};
+                std::atomic<Util::SlotStage> stage{Util::SlotStage::Free};
+            };
+            //The index gives the largest block exactly, a slot only holds what isn't mapped
+            u64 largestInput = 0, largestOutput = 0;
+            for (const BlockInfo& info : index) {
+                largestInput = std::max<u64>(largestInput, info.size);
+                largestOutput = std::max<u64>(largestOutput, info.originalSize);
+            }
+            u32 threads;
+            u64 slotCount;
+            if (!planPipeline(options.threads, options.maxInFlight, options.memoryLimit, (reader.mapped ? 0 : largestInput) + (mappedOutput.empty() ? largestOutput : 0), DecodeWorkspace::bound(), threads, slotCount)) return false;
+            vector<Slot> slots(slotCount);
+            const bool checked = Container::hasChecksums(version);
+            std::atomic<bool> writeFailed{false}, checksumFailed{false};
+            std::atomic<u32> missingPreset{0};
+            Util::RunStats stats;
+            Util::Progress progress{options.progress, footer.originalSize};
+            bool decoded = false;
+            u64 writtenBytes = 0;
+            {
+                ThreadPool pool(threads);
+                u64 nextBlock = 0, outputOffset = 0;
+                decoded = Util::runPipeline(slots, pool,
+                    [&](Slot& slot) {
+                        if (nextBlock == index.size()) return Util::ReadStatus::End;
+                        const BlockInfo& info = index[nextBlock++];
+                        reader.seek(info.offset);
+                        slot.input = reader.nextView(slot.buffer, info.size);
+                        slot.outputOffset = outputOffset;
+                        slot.originalSize = info.originalSize;
+                        slot.checksum = info.checksum;
+                        outputOffset += info.originalSize;
+                        return slot.input.size() == info.size ? Util::ReadStatus::Filled : Util::ReadStatus::Failed;
+                    },
+                    [&writer, &writeFailed, &checksumFailed, &missingPreset, mappedOutput, checked, discard](Slot& slot) {
+                        Util::StageClock clock;
+                        slot.coding = {};
+                        const auto decode = [&slot, &clock, &checksumFailed, &missingPreset, checked](span<u8> result) {
+                            if (!decompressBlock(slot.input, result, &slot.coding)) {
+                                if (const u32 id = unknownPreset(slot.input); id != 0) missingPreset.store(id, std::memory_order_relaxed);
+                                return false;
+                            }
+                            slot.coding.codingTime = clock.lap() - slot.coding.tableTime;
+                            if (!checked) return true;
+                            const bool matches = Checksum::crc32c(result) == slot.checksum;
+                            slot.coding.checksumTime = clock.lap();
+                            if (!matches) checksumFailed.store(true, std::memory_order_relaxed);
+                            return matches;
+                        };
+                        if (!mappedOutput.empty()) return decode(mappedOutput.subspan(slot.outputOffset, slot.originalSize));
+                        slot.output.resize(slot.originalSize);
+                        if (!decode(slot.output)) return false;
+                        if (discard || writer.writeAt(slot.outputOffset, slot.output)) return true;
+                        writeFailed.store(true, std::memory_order_relaxed);
+                        return false;
+                    },
+                    [&stats, &progress, &writtenBytes](Slot& slot) {
+                        writtenBytes += slot.originalSize;
+                        stats.coding.add(slot.coding);
+                        stats.blockTypes[slot.input[0]]++;
+                        progress.update(writtenBytes);
+                        return true;
+                    }, stats.pipeline);
+            }
+            progress.finish(writtenBytes);
+            for (const Slot& slot : slots) stats.peakBufferBytes += slot.buffer.capacity() + slot.output.capacity();
+            stats.memoryLimit = options.memoryLimit;
+            decodedBytes = writtenBytes;
+            if (writeFailed.load()) {
+                Util::setError(string("无法写入输出文件：") + STR(outputPath));
+                return false;
+            }
+            if (!decoded) {
+                Util::setError(checksumFailed.load() ? CHECKSUM_ERROR : blockError(missingPreset.load()));
+                return false;
+            }
+            stats.inputBytes = reader.fileSize;
+            stats.outputBytes = writtenBytes;
+            if (options.stats != Util::StatsFormat::None) Util::printStats(discard ? "test" : "decompress", stats, options.stats);
+            return true;
+        }
+
+        //Block versions from a pipe or to stdout: blocks are parsed in order, decoded on the pool and written back in order, the index and the CRCs are checked at the end
+        [[nodiscard]] bool decompressBlockStream(FileReader& reader, u32 version, const path& outputPath, const DecompressOptions& options, u64& decodedBytes) noexcept {
+            array<u8, 4> buffer{};
+            if (!reader.read(buffer.data(), 4)) {
+                Util::setError(INVALID_LZIP_FILE_ERROR);
+                return false;
+            }
+            const u32 maxBlockSize = Util::readIntLE<u32>(buffer.data());
+            FileWriter writer(outputPath);
+            if (!outputPath.empty() && !writer.isOpen()) {
+                Util::setError(string("无法打开输出文件：") + STR(outputPath));
+                return false;
+            }
+            //The reader thread parses blocks into the ring, they are decoded on the pool and written back in order
+            struct Slot {
+                vector<u8> input, output;
+                u32 checksum{0};
+                Util::CodingStats coding;
+                bool succeeded{false};
+                std::atomic<Util::SlotStage> stage{Util::SlotStage::Free};
+            };
+            u32 threads;
+            u64 slotCount;
+            if (!planPipeline(options.threads, options.maxInFlight, options.memoryLimit, Container::codedBlockBytes(maxBlockSize) + maxBlockSize, DecodeWorkspace::bound(), threads, slotCount)) return false;
+            vector<Slot> slots(slotCount);
+            const bool checked = Container::hasChecksums(version);
+            vector<BlockInfo> blocks;
+            //Filled by the writer in block order, `blocks` belongs to the reader thread until the pipeline is done
+            vector<u32> checksums;
+            u64 offset = Container::FILE_HEADER_SIZE, writtenBytes = 0;
+            Util::RunStats stats;
+            //A pipe's size isn't known, so this only counts up
+            Util::Progress progress{options.progress, 0};
+            std::atomic<u32> missingPreset{0};
+            bool decoded = false;
+            {
+                ThreadPool pool(threads);
+                decoded = Util::runPipeline(slots, pool,
+                    [&](Slot& slot) {
+                        slot.input.clear();
+                        if (reader.nextChunk(slot.input, 1) != 1) return Util::ReadStatus::Failed;
+                        if (slot.input[0] == static_cast<u8>(BlockType::Index)) return Util::ReadStatus::End;
+                        if (reader.nextChunk(slot.input, Container::BLOCK_HEADER_SIZE - 1) != Container::BLOCK_HEADER_SIZE - 1) return Util::ReadStatus::Failed;
+                        const BlockHeader header = Container::readBlockHeader(slot.input.data());
+                        const u64 remaining = Container::tableSize(header.type) + header.payloadSize;
+                        if (header.originalSize == 0 || header.originalSize > maxBlockSize || header.payloadSize > Container::maxPayloadSize(header.originalSize) || reader.nextChunk(slot.input, remaining) != remaining) return Util::ReadStatus::Failed;
+                        blocks.emplace_back(offset, header.originalSize, static_cast<u32>(slot.input.size()));
+                        offset += slot.input.size();
+                        return Util::ReadStatus::Filled;
+                    },
+                    [checked, &missingPreset](Slot& slot) {
+                        Util::StageClock clock;
+                        slot.coding = {};
+                        slot.output.resize(Container::readBlockHeader(slot.input.data()).originalSize);
+                        if (!decompressBlock(slot.input, slot.output, &slot.coding)) {
+                            if (const u32 id = unknownPreset(slot.input); id != 0) missingPreset.store(id, std::memory_order_relaxed);
+                            return false;
+                        }
+                        slot.coding.codingTime = clock.lap() - slot.coding.tableTime;
+                        if (checked) {
+                            slot.checksum = Checksum::crc32c(slot.output);
+                            slot.coding.checksumTime = clock.lap();
+                        }
+                        return true;
+                    },
+                    [&](Slot& slot) {
+                        checksums.push_back(slot.checksum);
+                        writer.writeChunk(slot.output);
+                        //A pipe may carry a live stream whose blocks are flushed frames, each goes on as soon as it's decoded
+                        if (!reader.seekable) static_cast<void>(writer.flush());
+                        writtenBytes += slot.output.size();
+                        stats.coding.add(slot.coding);
+                        stats.blockTypes[slot.input[0]]++;
+                        progress.update(writtenBytes);
+                        return true;
+                    }, stats.pipeline);
+            }
+            progress.finish(writtenBytes);
+            decodedBytes = writtenBytes;
+            for (const Slot& slot : slots) stats.peakBufferBytes += slot.input.capacity() + slot.output.capacity();
+            stats.memoryLimit = options.memoryLimit;
+            if (!writer.flush()) {
+                Util::setError(string("无法写入输出文件：") + STR(outputPath));
+                return false;
+            }
+            //Whatever follows the index marker is the index and the footer, they must describe exactly the blocks seen
+            vector<u8> indexData{static_cast<u8>(BlockType::Index)};
+            while (decoded && reader.nextChunk(indexData, IO_CHUNK_SIZE) > 0) {}
+            for (u64 i = 0; i < checksums.size() && i < blocks.size(); i++) blocks[i].checksum = checksums[i];
+            const u64 footerSize = Container::footerSize(version);
+            Footer footer;
+            vector<BlockInfo> index;
+            if (!decoded || indexData.size() < 1 + footerSize || !Container::readFooter(indexData.data() + indexData.size() - footerSize, offset + indexData.size(), version, footer) ||
+                footer.indexOffset != offset || !Container::readIndex(indexData, footer, maxBlockSize, index) || index != blocks) {
+                Util::setError(decoded && Container::sameLayout(index, blocks) ? CHECKSUM_ERROR : blockError(missingPreset.load()));
+                return false;
+            }
+            stats.inputBytes = offset + indexData.size();
+            stats.outputBytes = writtenBytes;
+            if (options.stats != Util::StatsFormat::None) Util::printStats(outputPath.empty() ? "test" : "decompress", stats, options.stats);
+            return true;
+        }
+
+        //Opens a block version file once and serves ranges of its original data, decoding and checking only the blocks that overlap them
+        struct BlockArchive {
+            FileReader reader;
+            Footer footer;
+            vector<BlockInfo> index;
+            //Original offset of every block, followed by the total size
+            vector<u64> blockStarts;
+            vector<u8> buffer, decoded;
+            //The last decoded block is kept for ranges that continue in it
+            u64 decodedBlock{~0ull};
+
+            [[nodiscard]] explicit BlockArchive(const path& filePath) noexcept : reader(filePath) {}
+
+            [[nodiscard]] bool load() noexcept {
+                array<u8, 8> magic{};
+                if (!reader.read(magic.data(), 8) || !Container::isMagic(magic.data())) {
+                    Util::setError(INVALID_LZIP_FILE_ERROR);
+                    return false;
+                }
+                const u32 version = Util::readIntLE<u32>(magic.data() + 4);
+                if (!Container::isBlockVersion(version)) {
+                    Util::setError("只有分块格式（版本 2 及以上）的文件支持随机访问。");
+                    return false;
+                }
+                if (!readBlockIndex(reader, version, footer, index)) {
+                    Util::setError(INVALID_LZIP_FILE_ERROR);
+                    return false;
+                }
+                blockStarts.resize(index.size() + 1);
+                blockStarts[0] = 0;
+                for (u64 i = 0; i < index.size(); i++) blockStarts[i + 1] = blockStarts[i] + index[i].originalSize;
+                decodedBlock = ~0ull;
+                return true;
+            }
+
+            //Appends up to `length` bytes starting at `offset`, ranges running past the end are cut short
+            [[nodiscard]] bool read(u64 offset, u64 length, vector<u8>& result) noexcept {
+                if (offset > footer.originalSize) {
+                    Util::setError("提取范围超出原始文件大小。");
+                    return false;
+                }
+                length = std::min(length, footer.originalSize - offset);
+                u64 block = static_cast<u64>(std::upper_bound(blockStarts.begin(), blockStarts.end(), offset) - blockStarts.begin()) - 1;
+                while (length > 0) {
+                    if (block != decodedBlock) {
+                        const BlockInfo& info = index[block];
+                        reader.seek(info.offset);
+                        const span<const u8> blockData = reader.nextView(buffer, info.size);
+                        decoded.resize(info.originalSize);
+                        decodedBlock = ~0ull;
+                        if (blockData.size() != info.size || !decompressBlock(blockData, decoded)) {
+                            Util::setError(blockError(unknownPreset(blockData)));
+                            return false;
+                        }
+                        if (Container::hasChecksums(footer.version) && Checksum::crc32c(decoded) != info.checksum) {
+                            Util::setError(CHECKSUM_ERROR);
+                            return false;
+                        }
+                        decodedBlock = block;
+                    }
+                    const u64 start = offset - blockStarts[block], count = std::min(length, decoded.size() - start);
+                    result.insert(result.end(), decoded.begin() + static_cast<std::ptrdiff_t>(start), decoded.begin() + static_cast<std::ptrdiff_t>(start + count));
+                    offset += count;
+                    length -= count;
+                    block++;
+                }
+                return true;
+            }
+        };
+
+        //Reads the magic and version, then decodes with whichever decoder fits the version and the files; an empty `outputPath` discards the result
+        [[nodiscard]] bool decodeFile(FileReader& reader, const path& inputPath, const path& outputPath, const DecompressOptions& options, u32& version, u64& decodedBytes) noexcept {
+            //Every decoder sizes or truncates the output before reading the blocks it maps from the input
+            if (sameFile(inputPath, outputPath)) {
+                Util::setError(string("输出文件与输入文件相同：") + STR(outputPath));
+                return false;
+            }
+            array<u8, 8> magic{};
+            if (!reader.read(magic.data(), 8) || !Container::isMagic(magic.data())) {
+                Util::setError(INVALID_LZIP_FILE_ERROR);
+                return false;
+            }
+            version = Util::readIntLE<u32>(magic.data() + 4);
+            if (version == LZIP_LEGACY_VERSION) return decompressLegacyStream(reader, outputPath, options, decodedBytes);
+            if (!Container::isBlockVersion(version)) {
+                Util::setError("不支持的 Lzip 文件版本。");
+                return false;
+            }
+            //Positional writes need a seekable input for the index and a real output file
+            if (reader.seekable && outputPath != Util::STDIO_PATH) return decompressBlocks(reader, version, outputPath, options, decodedBytes);
+            return decompressBlockStream(reader, version, outputPath, options, decodedBytes);
+        }
+
+        //Files up to a block are read, compressed and written whole on the pool in packs, larger ones go block by block like in `compressFile`
+        struct BatchFile {
+            path inputPath, outputPath;
+            u64 size{0};
+        };
+
+        //Every file in a pack counts as at least this many bytes, so a pack of empty files still spreads over the pool
+        constexpr u64 PACK_FILE_COST = 4096;
+        constexpr u32 PACK_MAX_FILES = 256;
+
+        //Walks `inputs` for files to compress and settles their outputs; files that are skipped or can't be compressed never reach the pipeline
+        void collectFiles(const vector<string>& inputs, const CompressOptions& options, vector<BatchFile>& files, vector<string>& failures, u64& skipped) noexcept {
+            const auto add = [&](const path& inputPath) {
+                path outputPath = inputPath;
+                outputPath += ".lzip";
+                const OutputCheck check = checkOutput(inputPath, outputPath, options.confirmOverwrite);
+                if (check == OutputCheck::Skip) skipped++;
+                if (check != OutputCheck::Proceed) {
+                    if (check == OutputCheck::Fail) failures.push_back(Util::getLastError());
+                    return;
+                }
+                error_code ec;
+                const u64 size = file_size(inputPath, ec);
+                if (ec) failures.push_back(string("无法打开输入文件：") + STR(inputPath));
+                else files.push_back({inputPath, outputPath, size});
+            };
+            for (const string& input : inputs) {
+                path inputPath(input);
+                error_code ec;
+                if (input == "-" || !normalize(inputPath) || !exists(inputPath, ec)) {
+                    failures.push_back(string("输入文件路径有误：") + input);
+                    continue;
+                }
+                if (!is_directory(inputPath, ec)) {
+                    add(inputPath);
+                    continue;
+                }
+                if (!options.recursive) {
+                    failures.push_back(string("输入是目录，需要 -r 才能压缩其中的文件：") + STR(inputPath));
+                    continue;
+                }
+                for (recursive_directory_iterator it(inputPath, std::filesystem::directory_options::skip_permission_denied, ec), end; !ec && it != end; it.increment(ec)) {
+                    //Archives already there would otherwise be compressed again on every run
+                    if (it->is_regular_file(ec) && it->path().extension() != ".lzip") add(it->path());
+                }
+                if (ec) failures.push_back(string("无法遍历目录：") + STR(inputPath));
+            }
+        }
+
+        //A block of the large file `file`, or the `packCount` small files from `file` on
+        struct BatchSlot {
+            u64 file{0};
+            u32 packCount{0};
+            //Keeps the mapping `input` views alive until the block has been written
+            shared_ptr<FileReader> reader;
+            span<const u8> input;
+            vector<u8> buffer, output;
+            u32 checksum{0};
+            bool lastBlock{false};
+            //Why the large file stopped early, or why each failed file of a pack did
+            string error;
+            vector<string> packErrors;
+            //Block type of every file in a pack, for the statistics
+            vector<u8> packTypes;
+            u64 packInput{0}, packOutput{0};
+            Encoder encoder;
+            Util::CodingStats coding;
+            bool succeeded{false};
+            std::atomic<Util::SlotStage> stage{Util::SlotStage::Free};
+        };
+
+        //Live input on the calling thread: blocks go out as soon as they fill, and what waits for a full block is flushed as a short block once its oldest byte has waited `flushInterval`, or sooner if the input pauses that long
+        //Each flush is a complete block, so a reader decodes everything before it without waiting for more; `flushes` counts the short blocks
+        [[nodiscard]] bool compressFramed(FileReader& reader, FileWriter& writer, const CompressOptions& options, u64& originalSize, u64& flushes) noexcept {
+            Encoder encoder(options);
+            vector<u8> input, output;
+            //When the oldest byte not sent yet arrived, while `waiting`
+            steady_clock::time_point oldest;
+            bool waiting = false;
+            const auto send = [&writer, &output]() {
+                writer.writeChunk(output);
+                output.clear();
+                return writer.flush();
+            };
+            while (true) {
+                if (waiting) {
+                    const u64 waited = static_cast<u64>(duration_cast<milliseconds>(steady_clock::now() - oldest).count());
+                    if (waited >= options.flushInterval || !reader.waitReadable(static_cast<u32>(options.flushInterval - waited))) {
+                        encoder.flush(output);
+                        flushes++;
+                        waiting = false;
+                        if (!send()) return false;
+                        continue;
+                    }
+                }
+                input.clear();
+                if (reader.nextAvailable(input, IO_CHUNK_SIZE) == 0) break;
+                if (!waiting) oldest = steady_clock::now();
+                waiting = true;
+                originalSize += input.size();
+                encoder.update(input, output);
+                if (!output.empty() && !send()) return false;
+            }
+            encoder.finish(output);
+            return send();
+        }
+
+        void compressPack(BatchSlot& slot, span<const BatchFile> files) noexcept {
+            slot.packErrors.clear();
+            slot.packTypes.clear();
+            slot.packInput = slot.packOutput = 0;
+            slot.coding = {};
+            for (const BatchFile& file : files) {
+                FileReader reader(file.inputPath);
+                if (!reader.isOpen()) {
+                    slot.packErrors.push_back(string("无法打开输入文件：") + STR(file.inputPath));
+                    continue;
+                }
+                slot.output.clear();
+                Util::StageClock clock;
+                //Read to the end whatever the size was when it was listed
+                for (span<const u8> input = reader.nextView(slot.buffer, Container::MAX_BLOCK_SIZE); !input.empty(); input = reader.nextView(slot.buffer, Container::MAX_BLOCK_SIZE)) {
+                    slot.encoder.update(input, slot.output);
+                    slot.packInput += input.size();
+                }
+                slot.encoder.finish(slot.output);
+                slot.coding.codingTime += clock.lap();
+                bool written = false;
+                {
+                    FileWriter writer(file.outputPath);
+                    if (!writer.isOpen()) {
+                        slot.packErrors.push_back(string("无法打开输出文件：") + STR(file.outputPath));
+                        continue;
+                    }
+                    writer.writeAll(slot.output);
+                    written = writer.flush();
+                }
+                if (!written) {
+                    error_code ec;
+                    remove(file.outputPath, ec);
+                    slot.packErrors.push_back(string("无法写入输出文件：") + STR(file.outputPath));
+                    continue;
+                }
+                slot.packOutput += slot.output.size();
+                //A packed file fits in one block, or has none when it's empty
+                if (slot.output.size() > Container::FILE_HEADER_SIZE + 1 + Container::FOOTER_SIZE) slot.packTypes.push_back(slot.output[Container::FILE_HEADER_SIZE]);
+            }
+        }
+    }
+
+    [[nodiscard]] bool compressFile(const string& inputFile, const string& outputFile, const CompressOptions& options) noexcept {
+        steady_clock::time_point startTime = steady_clock::now();
+        path inputPath(inputFile);
+        if (!normalize(inputPath)) {
+            Util::setError(string("输入文件路径有误：") + inputFile);
+            return false;
+        }
+        //Reading stdin writes stdout unless told otherwise
+        path outputPath = !outputFile.empty() ? path(outputFile) : inputPath == Util::STDIO_PATH ? Util::STDIO_PATH : path(inputFile + ".lzip");
+        if (!normalize(outputPath)) {
+            Util::setError(string("输出文件路径有误：") + outputFile);
+            return false;
+        }
+        const OutputCheck check = checkOutput(inputPath, outputPath, options.confirmOverwrite);
+        if (check != OutputCheck::Proceed) return check == OutputCheck::Skip;
+        FileReader reader(inputPath);
+        if (!reader.isOpen()) {
+            Util::setError(string("无法打开输入文件：") + reinterpret_cast<const char*>(inputPath.u8string().c_str()));
+            return false;
+        }
+        //Before the output is created, so a limit that's too small leaves nothing behind
+        u32 threads;
+        u64 slotCount;
+        if (!planPipeline(options.threads, options.maxInFlight, options.memoryLimit, (reader.mapped ? 0 : options.blockSize) + Container::codedBlockBytes(options.blockSize), EncodeWorkspace::bound(options), threads, slotCount)) return false;
+        FileWriter writer(outputPath);
+        if (!writer.isOpen()) {
+            Util::setError(string("无法打开输出文件：") + reinterpret_cast<const char*>(outputPath.u8string().c_str()));
+            return false;
+        }
+        if (options.flushInterval > 0) {
+            u64 originalSize = 0, flushes = 0;
+            if (!compressFramed(reader, writer, options, originalSize, flushes)) {
+                Util::setError(string("无法写入输出文件：") + reinterpret_cast<const char*>(outputPath.u8string().c_str()));
+                return false;
+            }
+            Util::status() << "压缩完成，耗时 " << duration_cast<milliseconds>(steady_clock::now() - startTime).count() << " 毫秒，刷新 " << flushes << " 次\n输出文件：" << reinterpret_cast<const char*>(outputPath.u8string().c_str()) << '\n';
+            if (originalSize > 0) Util::status() << "压缩比：" << fixed << setprecision(2) << (static_cast<double>(writer.fileSize()) / originalSize) * 100 << "%\n";
+            return true;
+        }
+        vector<u8> outputData;
+        Container::writeFileHeader(outputData, static_cast<u32>(options.blockSize), Container::streamVersion(options.preset));
+        writer.writeChunk(outputData);
+        u64 offset = outputData.size();
+        outputData.clear();
+        //The reader thread fills the ring, blocks are encoded on the pool and written back in input order
+        //`input` views the mapped file, or `buffer` when reading from a stream
+        struct Slot {
+            span<const u8> input;
+            vector<u8> buffer, output;
+            u32 checksum{0};
+            Util::CodingStats coding;
+            bool succeeded{false};
+            std::atomic<Util::SlotStage> stage{Util::SlotStage::Free};
+        };
+        vector<Slot> slots(slotCount);
+        vector<BlockInfo> index;
+        u64 originalSize = 0;
+        Util::RunStats stats;
+        Util::Progress progress{options.progress, reader.seekable ? reader.fileSize : 0};
+        {
+            ThreadPool pool(threads);
+            //Encoding a block can't fail, and neither can writing it until the final flush
+            static_cast<void>(Util::runPipeline(slots, pool,
+                [&reader, &options](Slot& slot) {
+                    slot.input = reader.nextView(slot.buffer, options.blockSize);
+                    return slot.input.empty() ? Util::ReadStatus::End : Util::ReadStatus::Filled;
+                },
+                [&options](Slot& slot) {
+                    Util::StageClock clock;
+                    slot.output.clear();
+                    slot.coding = {};
+                    //First, so the coders find the block in cache
+                    slot.checksum = Checksum::crc32c(slot.input);
+                    slot.coding.checksumTime = clock.lap();
+                    compressBlock(slot.input, slot.output, options, &slot.coding);
+                    slot.coding.codingTime = clock.lap() - slot.coding.histogramTime - slot.coding.tableTime;
+                    return true;
+                },
+                [&](Slot& slot) {
+                    index.emplace_back(offset, static_cast<u32>(slot.input.size()), static_cast<u32>(slot.output.size()), slot.checksum);
+                    writer.writeChunk(slot.output);
+                    offset += slot.output.size();
+                    originalSize += slot.input.size();
+                    stats.coding.add(slot.coding);
+                    stats.blockTypes[slot.output[0]]++;
+                    progress.update(originalSize);
+                    return true;
+                }, stats.pipeline));
+        }
+        progress.finish(originalSize);
+        for (const Slot& slot : slots) stats.peakBufferBytes += slot.buffer.capacity() + slot.output.capacity();
+        stats.memoryLimit = options.memoryLimit;
+        //The original size is only known here, so it goes into the footer rather than the header
+        Container::writeIndex(outputData, index, offset, originalSize);
+        writer.writeChunk(outputData);
+        if (!writer.flush()) {
+            Util::setError(string("无法写入输出文件：") + reinterpret_cast<const char*>(outputPath.u8string().c_str()));
+            return false;
+        }
+        Util::status() << "压缩完成，耗时 " << duration_cast<milliseconds>(steady_clock::now() - startTime).count() << " 毫秒\n输出文件：" << reinterpret_cast<const char*>(outputPath.u8string().c_str()) << '\n';
+        if (originalSize > 0) Util::status() << "压缩比：" << fixed << setprecision(2) << (static_cast<double>(writer.fileSize()) / originalSize) * 100 << "%\n";
+        stats.inputBytes = originalSize;
+        stats.outputBytes = writer.fileSize();
+        if (options.stats != Util::StatsFormat::None) Util::printStats("compress", stats, options.stats);
+        return true;
+    }
+
+    [[nodiscard]] bool compressFiles(const vector<string>& inputs, const CompressOptions& options) noexcept {
+        steady_clock::time_point startTime = steady_clock::now();
+        vector<BatchFile> files;
+        vector<string> failures;
+        u64 skipped = 0;
+        collectFiles(inputs, options, files, failures, skipped);
+        //A slot holds a block read from a file that couldn't be mapped, a packed file waiting in its encoder, and either coded
+        u32 threads;
+        u64 slotCount;
+        if (!planPipeline(options.threads, options.maxInFlight, options.memoryLimit, options.blockSize * 2 + Container::codedBlockBytes(options.blockSize), EncodeWorkspace::bound(options), threads, slotCount)) return false;
+        //Packs are sized so there are a few per thread even when every file is tiny, and never more than a block
+        u64 smallBytes = 0, totalBytes = 0;
+        for (const BatchFile& file : files) {
+            if (file.size <= options.blockSize) smallBytes += std::max(file.size, PACK_FILE_COST);
+            totalBytes += file.size;
+        }
+        const u64 packBudget = std::clamp<u64>(smallBytes / (threads * 4), PACK_FILE_COST, options.blockSize);
+        vector<BatchSlot> slots(slotCount);
+        for (BatchSlot& slot : slots) slot.encoder = Encoder(options);
+        //Reader state: the next file to hand out, and the large file being split with the bytes it has left
+        u64 next = 0, remaining = 0;
+        shared_ptr<FileReader> current;
+        //Writer state for the large file being assembled; `failedFile` drops the blocks that follow a failure
+        unique_ptr<FileWriter> writer;
+        vector<BlockInfo> index;
+        vector<u8> outputData;
+        u64 offset = 0, fileInput = 0, currentFile = files.size(), failedFile = files.size(), compressed = 0, done = 0;
+        Util::RunStats stats;
+        Util::Progress progress{options.progress, totalBytes};
+        {
+            ThreadPool pool(threads);
+            //Failures are per file and collected by the writer, so the pipeline itself always runs to the end
+            static_cast<void>(Util::runPipeline(slots, pool,
+                [&](BatchSlot& slot) {
+                    slot.error.clear();
+                    slot.lastBlock = false;
+                    slot.packCount = 0;
+                    slot.reader.reset();
+                    if (!current && next < files.size() && files[next].size > options.blockSize) {
+                        current = std::make_shared<FileReader>(files[next].inputPath);
+                        remaining = files[next].size;
+                        if (!current->isOpen()) {
+                            slot.file = next++;
+                            slot.error = string("无法打开输入文件：") + STR(files[slot.file].inputPath);
+                            slot.lastBlock = true;
+                            current.reset();
+                            return Util::ReadStatus::Filled;
+                        }
+                    }
+                    if (current) {
+                        slot.file = next;
+                        slot.reader = current;
+                        slot.input = current->nextView(slot.buffer, std::min(remaining, options.blockSize));
+                        if (slot.input.empty()) slot.error = string("输入文件在压缩时被改动：") + STR(files[next].inputPath);
+                        remaining -= slot.input.size();
+                        if (remaining == 0 || !slot.error.empty()) {
+                            slot.lastBlock = true;
+                            current.reset();
+                            next++;
+                        }
+                        return Util::ReadStatus::Filled;
+                    }
+                    if (next == files.size()) return Util::ReadStatus::End;
+                    slot.file = next;
+                    for (u64 cost = 0; next < files.size() && files[next].size <= options.blockSize && slot.packCount < PACK_MAX_FILES; next++, slot.packCount++) {
+                        cost += std::max(files[next].size, PACK_FILE_COST);
+                        if (slot.packCount > 0 && cost > packBudget) break;
+                    }
+                    return Util::ReadStatus::Filled;
+                },
+                [&options, &files](BatchSlot& slot) {
+                    if (slot.packCount > 0) {
+                        compressPack(slot, span<const BatchFile>(files).subspan(slot.file, slot.packCount));
+                        return true;
+                    }
+                    if (!slot.error.empty()) return true;
+                    Util::StageClock clock;
+                    slot.output.clear();
+                    slot.coding = {};
+                    slot.checksum = Checksum::crc32c(slot.input);
+                    slot.coding.checksumTime = clock.lap();
+                    compressBlock(slot.input, slot.output, options, &slot.coding);
+                    slot.coding.codingTime = clock.lap() - slot.coding.histogramTime - slot.coding.tableTime;
+                    return true;
+                },
+                [&](BatchSlot& slot) {
+                    stats.coding.add(slot.coding);
+                    if (slot.packCount > 0) {
+                        failures.insert(failures.end(), slot.packErrors.begin(), slot.packErrors.end());
+                        compressed += slot.packCount - slot.packErrors.size();
+                        for (const u8 type : slot.packTypes) stats.blockTypes[type]++;
+                        stats.inputBytes += slot.packInput;
+                        stats.outputBytes += slot.packOutput;
+                        //Files that failed to open still count, so the total is reached
+                        for (const BatchFile& file : span<const BatchFile>(files).subspan(slot.file, slot.packCount)) done += file.size;
+                        progress.update(done);
+                        return true;
+                    }
+                    if (slot.file == failedFile) return true;
+                    const BatchFile& file = files[slot.file];
+                    if (slot.file != currentFile) {
+                        currentFile = slot.file;
+                        fileInput = 0;
+                    }
+                    if (slot.error.empty() && !writer) {
+                        writer = std::make_unique<FileWriter>(file.outputPath);
+                        if (writer->isOpen()) {
+                            outputData.clear();
+                            Container::writeFileHeader(outputData, static_cast<u32>(options.blockSize), Container::streamVersion(options.preset));
+                            writer->writeChunk(outputData);
+                            offset = outputData.size();
+                            index.clear();
+                        }
+                        else {
+                            slot.error = string("无法打开输出文件：") + STR(file.outputPath);
+                            writer.reset();
+                        }
+                    }
+                    if (slot.error.empty()) {
+                        index.emplace_back(offset, static_cast<u32>(slot.input.size()), static_cast<u32>(slot.output.size()), slot.checksum);
+                        writer->writeChunk(slot.output);
+                        offset += slot.output.size();
+                        fileInput += slot.input.size();
+                        done += slot.input.size();
+                        stats.blockTypes[slot.output[0]]++;
+                    }
+                    if (slot.error.empty() && slot.lastBlock) {
+                        outputData.clear();
+                        Container::writeIndex(outputData, index, offset, fileInput);
+                        writer->writeChunk(outputData);
+                        if (writer->flush()) {
+                            compressed++;
+                            stats.inputBytes += fileInput;
+                            stats.outputBytes += writer->fileSize();
+                        }
+                        else slot.error = string("无法写入输出文件：") + STR(file.outputPath);
+                    }
+                    if (!slot.error.empty()) {
+                        failures.push_back(slot.error);
+                        failedFile = slot.file;
+                        //Only an output this run created is removed, an existing one the caller kept is left alone
+                        if (writer) {
+                            writer.reset();
+                            error_code ec;
+                            remove(file.outputPath, ec);
+                        }
+                        done += file.size - std::min(fileInput, file.size);
+                    }
+                    if (slot.lastBlock) writer.reset();
+                    progress.update(done);
+                    return true;
+                }, stats.pipeline));
+        }
+        progress.finish(done);
+        for (const BatchSlot& slot : slots) stats.peakBufferBytes += slot.buffer.capacity() + slot.output.capacity();
+        stats.memoryLimit = options.memoryLimit;
+        Util::status() << "批量压缩完成，耗时 " << duration_cast<milliseconds>(steady_clock::now() - startTime).count() << " 毫秒\n压缩 " << compressed << " 个文件，跳过 " << skipped << " 个，失败 " << failures.size() << " 个\n";
+        if (stats.inputBytes > 0) Util::status() << "压缩比：" << fixed << setprecision(2) << (static_cast<double>(stats.outputBytes) / stats.inputBytes) * 100 << "%\n";
+        if (options.stats != Util::StatsFormat::None) Util::printStats("compress", stats, options.stats);
+        if (failures.empty()) return true;
+        string message = "有 " + std::to_string(failures.size()) + " 个文件未能压缩：";
+        for (const string& failure : failures) message += "\n  " + failure;
+        Util::setError(message);
+        return false;
+    }
+
+    [[nodiscard]] bool decompressFile(const string& inputFile, const string& outputFile, const DecompressOptions& options) noexcept {
+        steady_clock::time_point startTime = steady_clock::now();
+        path inputPath(inputFile);
+        if (!normalize(inputPath)) {
+            Util::setError(string("输入文件路径有误：") + inputFile);
+            return false;
+        }
+        path outputPath;
+        if (outputFile.empty() && inputPath == Util::STDIO_PATH) outputPath = Util::STDIO_PATH;
+        else if (outputFile.empty()) {
+            //Without the suffix there is no name to strip it from, and the input's own name is the one thing the output can't be
+            const string fileName = path(inputFile).filename().string();
+            if (!fileName.ends_with(".lzip") || fileName.size() == 5) {
+                Util::setError(string("输入文件名不以 .lzip 结尾，无法推断输出文件，请用 -o 指定：") + inputFile);
+                return false;
+            }
+            outputPath = path(inputFile).parent_path() / fileName.substr(0, fileName.size() - 5);
+        }
+        else outputPath = outputFile;
+        if (!normalize(outputPath)) {
+            Util::setError(string("输出文件路径有误：") + outputFile);
+            return false;
+        }
+        const OutputCheck check = checkOutput(inputPath, outputPath, options.confirmOverwrite);
+        if (check != OutputCheck::Proceed) return check == OutputCheck::Skip;
+        FileReader reader(inputPath);
+        if (!reader.isOpen()) {
+            Util::setError(string("无法打开输入文件：") + STR(inputPath));
+            return false;
+        }
+        u32 version = 0;
+        u64 decodedBytes = 0;
+        if (!decodeFile(reader, inputPath, outputPath, options, version, decodedBytes)) return false;
+        Util::status() << "解压完成，耗时 " << duration_cast<milliseconds>(steady_clock::now() - startTime).count() << " 毫秒\n输出文件：" << STR(outputPath) << '\n';
+        return true;
+    }
+
+    [[nodiscard]] bool testFile(const string& inputFile, const DecompressOptions& options) noexcept {
+        steady_clock::time_point startTime = steady_clock::now();
+        path inputPath(inputFile);
+        if (!normalize(inputPath)) {
+            Util::setError(string("输入文件路径有误：") + inputFile);
+            return false;
+        }
+        FileReader reader(inputPath);
+        if (!reader.isOpen()) {
+            Util::setError(string("无法打开输入文件：") + STR(inputPath));
+            return false;
+        }
+        u32 version = 0;
+        u64 decodedBytes = 0;
+        if (!decodeFile(reader, inputPath, path(), options, version, decodedBytes)) return false;
+        const double seconds = static_cast<double>(duration_cast<std::chrono::microseconds>(steady_clock::now() - startTime).count()) / 1e6;
+        Util::report() << "测试通过：" << STR(inputPath) << '\n' << fixed << setprecision(1) << "原始数据 " << decodedBytes << " 字节，耗时 " << seconds * 1000 << " 毫秒，"
+            << (seconds > 0 ? static_cast<double>(decodedBytes) / 1048576.0 / seconds : 0.0) << " MiB/s\n";
+        if (!Container::hasChecksums(version)) Util::report() << "版本 " << version << " 的文件没有校验和，只检查了能否完整解码。\n";
+        return true;
+    }
+
+    [[nodiscard]] bool extractFile(const string& inputFile, const string& outputFile, u64 offset, u64 length, const DecompressOptions& options) noexcept {
+        steady_clock::time_point startTime = steady_clock::now();
+        path inputPath(inputFile);
+        if (!normalize(inputPath)) {
+            Util::setError(string("输入文件路径有误：") + inputFile);
+            return false;
+        }
+        BlockArchive archive(inputPath);
+        if (!archive.reader.isOpen()) {
+            Util::setError(string("无法打开输入文件：") + STR(inputPath));
+            return false;
+        }
+        if (!archive.load()) return false;
+        if (offset > archive.footer.originalSize) {
+            Util::setError("提取范围超出原始文件大小。");
+            return false;
+        }
+        length = std::min(length, archive.footer.originalSize - offset);
+        path outputPath = outputFile.empty() ? Util::STDIO_PATH : path(outputFile);
+        if (!normalize(outputPath)) {
+            Util::setError(string("输出文件路径有误：") + outputFile);
+            return false;
+        }
+        const OutputCheck check = checkOutput(inputPath, outputPath, options.confirmOverwrite);
+        if (check != OutputCheck::Proceed) return check == OutputCheck::Skip;
+        FileWriter writer(outputPath);
+        if (!writer.isOpen()) {
+            Util::setError(string("无法打开输出文件：") + STR(outputPath));
+            return false;
+        }
+        vector<u8> outputData;
+        while (length > 0) {
+            const u64 count = std::min<u64>(length, Container::MAX_BLOCK_SIZE);
+            outputData.clear();
+            if (!archive.read(offset, count, outputData)) return false;
+            writer.writeChunk(outputData);
+            offset += count;
+            length -= count;
+        }
+        if (!writer.flush()) {
+            Util::setError(string("无法写入输出文件：") + STR(outputPath));
+            return false;
+        }
+        Util::status() << "提取完成，耗时 " << duration_cast<milliseconds>(steady_clock::now() - startTime).count() << " 毫秒\n输出文件：" << STR(outputPath) << '\n';
+        return true;
+    }
+
+    [[nodiscard]] bool trainPreset(const vector<string>& sampleFiles, const string& outputFile, const OverwritePrompt& confirmOverwrite, u32& id) noexcept {
+        steady_clock::time_point startTime = steady_clock::now();
+        id = 0;
+        path outputPath(outputFile);
+        if (!normalize(outputPath) || outputPath == Util::STDIO_PATH) {
+            Util::setError(string("输出文件路径有误：") + outputFile);
+            return false;
+        }
+        const bool fromStdin = std::find(sampleFiles.begin(), sampleFiles.end(), "-") != sampleFiles.end();
+        for (const string& sampleFile : sampleFiles) if (sameFile(path(sampleFile), outputPath)) {
+            Util::setError(string("输出文件与样本文件相同：") + STR(outputPath));
+            return false;
+        }
+        const OutputCheck check = checkOutput(fromStdin ? Util::STDIO_PATH : path(), outputPath, confirmOverwrite);
+        if (check != OutputCheck::Proceed) return check == OutputCheck::Skip;
+        array<u64, 256> frequencies{};
+        u64 sampleBytes = 0, sampleCount = 0;
+        const auto count = [&](const path& samplePath) {
+            FileReader reader(samplePath);
+            if (!reader.isOpen()) {
+                Util::setError(string("无法打开样本文件：") + STR(samplePath));
+                return false;
+            }
+            vector<u8> buffer;
+            for (span<const u8> data = reader.nextView(buffer, IO_CHUNK_SIZE); !data.empty(); data = reader.nextView(buffer, IO_CHUNK_SIZE)) {
+                Huffman::updateFrequency(data, frequencies);
+                sampleBytes += data.size();
+            }
+            sampleCount++;
+            return true;
+        };
+        for (const string& sampleFile : sampleFiles) {
+            path samplePath(sampleFile);
+            error_code ec;
+            if (!normalize(samplePath) || (samplePath != Util::STDIO_PATH && !exists(samplePath, ec))) {
+                Util::setError(string("样本文件路径有误：") + sampleFile);
+                return false;
+            }
+            if (samplePath == Util::STDIO_PATH || !is_directory(samplePath, ec)) {
+                if (!count(samplePath)) return false;
+                continue;
+            }
+            for (recursive_directory_iterator it(samplePath, std::filesystem::directory_options::skip_permission_denied, ec), end; !ec && it != end; it.increment(ec)) {
+                if (it->is_regular_file(ec) && !count(it->path())) return false;
+            }
+            if (ec) {
+                Util::setError(string("无法遍历目录：") + STR(samplePath));
+                return false;
+            }
+        }
+        if (sampleBytes == 0) {
+            Util::setError("样本文件都是空的。");
+            return false;
+        }
+        Preset::CodeLengths lengths;
+        Preset::train(frequencies, lengths);
+        vector<u8> outputData(Preset::FILE_MAGIC.begin(), Preset::FILE_MAGIC.end());
+        outputData.insert(outputData.end(), lengths.begin(), lengths.end());
+        FileWriter writer(outputPath);
+        if (!writer.isOpen()) {
+            Util::setError(string("无法打开输出文件：") + STR(outputPath));
+            return false;
+        }
+        writer.writeChunk(outputData);
+        if (!writer.flush()) {
+            Util::setError(string("无法写入输出文件：") + STR(outputPath));
+            return false;
+        }
+        id = Preset::trainedId(lengths);
+        Util::status() << "训练完成，耗时 " << duration_cast<milliseconds>(steady_clock::now() - startTime).count() << " 毫秒，样本 " << sampleCount << " 个文件共 " << sampleBytes << " 字节\n输出文件：" << STR(outputPath) << '\n';
+        return true;
+    }
+
+    [[nodiscard]] bool loadPreset(const string& file, u32& id) noexcept {
+        id = 0;
+        path presetPath(file);
+        if (!normalize(presetPath)) {
+            Util::setError(string("预设表文件路径有误：") + file);
+            return false;
+        }
+        FileReader reader(presetPath);
+        if (!reader.isOpen()) {
+            Util::setError(string("无法打开预设表文件：") + STR(presetPath));
+            return false;
+        }
+        array<u8, Preset::FILE_SIZE> data{};
+        Preset::CodeLengths lengths;
+        const bool valid = (!reader.seekable || reader.fileSize == Preset::FILE_SIZE) && reader.read(data.data(), data.size()) && std::equal(Preset::FILE_MAGIC.begin(), Preset::FILE_MAGIC.end(), data.begin());
+        std::copy(data.begin() + Preset::FILE_MAGIC.size(), data.end(), lengths.begin());
+        if (!valid || !Preset::registry().add(lengths, id)) {
+            Util::setError(string("不是有效的预设表文件：") + STR(presetPath));
+            return false;
+        }
+        return true;
+    }
+}
@@ -1,262 +1,388 @@
 ﻿#pragma once
 #include <array>
 #include <algorithm>
+#include <bit>
 #include <cassert>
-#include <queue>
+#include <cstdint>
+#include <cstring>
 #include <span>
-#include <sys/stat.h>
 #include <vector>
 
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+    #define _LZIP_AVX2 1
+    #define _LZIP_AVX2_TARGET __attribute__((target("avx2")))
+    #include <immintrin.h> // IWYU pragma: keep
+#elif defined(_M_X64) && defined(_MSC_VER)
+    #define _LZIP_AVX2 1
+    #define _LZIP_AVX2_TARGET
+    #include <immintrin.h> // IWYU pragma: keep
+    #include <intrin.h> // IWYU pragma: keep
+#endif
+
 namespace Lzip::Huffman {
     typedef uint8_t u8;
     typedef int16_t i16;
     typedef uint16_t u16;
+    typedef uint32_t u32;
     typedef uint64_t u64;
-    using std::array, std::span, std::vector, std::sort, std::priority_queue;
-
-    struct IndexedNode {
-        u64 frequency{0};
-        u16 left{0}, right{0};
-        u8 byte{0};
-        bool isLeaf{false};
-    };
-
-    struct IndexedNodeR {
-        u16 left{0xFFFFu}, right{0xFFFFu};
-        u8 byte{0};
-        bool isLeaf{false};
-    };
+    using std::array, std::span, std::vector, std::sort;
 
-    //`codeLen` is `u16` because it may exceed `u8` before length reduction, but since `maxCodeLen` is 64, we can use `u8` safely after that
+    //`codeLen` never exceeds `MAX_CODE_LEN`, so it's serialized as a `u8`
     struct HuffmanCode {
         u64 code{0};
         u16 codeLen{0};
     };
 
-    struct ByteFrequency {
-        u64 frequency{0};
-        u8 byte{0};
-    };
-
     //For deserialization only because `codeLen` is `u8`
-    struct ByteCodeLen {
-        u8 byte{0}, codeLen{0};
+    struct SymbolCodeLen {
+        u16 symbol{0};
+        u8 codeLen{0};
     };
 
-    struct IndexCodeLen {
-        u16 index{0}, codeLen{0};
-    };
+    inline constexpr u32 HISTOGRAM_TABLES = 4;
 
-    struct IndexCodeCodeLen {
-        u64 code{0};
-        u16 index{0};
-        u8 codeLen{0};
-    };
+    //Counting into one table makes a run of equal bytes wait on its own previous store, so neighbouring bytes go to different sub-tables
+    inline void countWord(u64 word, array<u32, 256 * HISTOGRAM_TABLES>& counts) noexcept {
+        counts[static_cast<u8>(word)]++;
+        counts[256 + static_cast<u8>(word >> 8)]++;
+        counts[512 + static_cast<u8>(word >> 16)]++;
+        counts[768 + static_cast<u8>(word >> 24)]++;
+        counts[static_cast<u8>(word >> 32)]++;
+        counts[256 + static_cast<u8>(word >> 40)]++;
+        counts[512 + static_cast<u8>(word >> 48)]++;
+        counts[768 + static_cast<u8>(word >> 56)]++;
+    }
 
-    struct IndexedNodeComparator {
-        const vector<IndexedNode>& nodesPtr;
-        [[nodiscard]] IndexedNodeComparator(const vector<IndexedNode>& nodes) noexcept : nodesPtr(nodes) {}
+    //Counters are `u32`, callers keep `data` below 4 GiB
+    inline void countInterleaved(span<const u8> data, array<u32, 256 * HISTOGRAM_TABLES>& counts) noexcept {
+        const u8* in = data.data();
+        u64 i = 0;
+        for (; i + 16 <= data.size(); i += 16) {
+            u64 first, second;
+            std::memcpy(&first, in + i, 8);
+            std::memcpy(&second, in + i + 8, 8);
+            countWord(first, counts);
+            countWord(second, counts);
+        }
+        for (; i < data.size(); i++) counts[in[i]]++;
+    }
 
-        [[nodiscard]] bool operator()(const u16& a, const u16& b) const noexcept {
-            const auto& nodeA = nodesPtr[a];
-            const auto& nodeB = nodesPtr[b];
-            if (nodeA.frequency != nodeB.frequency) return nodeA.frequency > nodeB.frequency;
-            //Prefer leaf nodes
-            if (nodeA.isLeaf != nodeB.isLeaf) return nodeA.isLeaf < nodeB.isLeaf;
-            return nodeA.byte < nodeB.byte;
+#if _LZIP_AVX2
+    //Same as `countInterleaved`, but 32 equal bytes, the worst case for scattered increments, are found with one compare and counted at once
+    _LZIP_AVX2_TARGET inline void countInterleavedAvx2(span<const u8> data, array<u32, 256 * HISTOGRAM_TABLES>& counts) noexcept {
+        const u8* in = data.data();
+        u64 i = 0;
+        for (; i + 32 <= data.size(); i += 32) {
+            const __m256i chunk = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in + i));
+            if (static_cast<u32>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, _mm256_set1_epi8(static_cast<char>(in[i]))))) == 0xFFFFFFFFu) {
+                counts[in[i]] += 32;
+                continue;
+            }
+            const __m128i low = _mm256_castsi256_si128(chunk), high = _mm256_extracti128_si256(chunk, 1);
+            countWord(static_cast<u64>(_mm_cvtsi128_si64(low)), counts);
+            countWord(static_cast<u64>(_mm_extract_epi64(low, 1)), counts);
+            countWord(static_cast<u64>(_mm_cvtsi128_si64(high)), counts);
+            countWord(static_cast<u64>(_mm_extract_epi64(high, 1)), counts);
         }
-    };
+        for (; i < data.size(); i++) counts[in[i]]++;
+    }
 
-    inline void updateFrequency(span<const u8> data, array<u64, 256>& frequencies) noexcept {
-        for (u64 i = 0; i < data.size(); i++) frequencies[data[i]]++;
+    [[nodiscard]] inline bool detectAvx2() noexcept {
+    #if defined(_MSC_VER) && !defined(__clang__)
+        int info[4];
+        __cpuid(info, 0);
+        if (info[0] < 7) return false;
+        __cpuid(info, 1);
+        //OSXSAVE and AVX, then the OS must save the YMM registers
+        if ((info[2] & (1 << 27)) == 0 || (info[2] & (1 << 28)) == 0 || (_xgetbv(0) & 6) != 6) return false;
+        __cpuidex(info, 7, 0);
+        return (info[1] & (1 << 5)) != 0;
+    #else
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("avx2");
+    #endif
     }
 
-    inline constexpr u16 MAX_CODE_LEN = 24;
-    [[nodiscard]] inline bool getHuffmanCode(const array<u64, 256>& frequencies, array<HuffmanCode, 256>& result, u16& presentedByteCount) noexcept {
-        result.fill({});
-        static array<ByteFrequency, 256> byteFrequencies{};
-        presentedByteCount = 0;
-        for (u16 i = 0; i < 256; i++) if (frequencies[i] > 0) {
-            byteFrequencies[presentedByteCount].frequency = frequencies[i];
-            byteFrequencies[presentedByteCount].byte = static_cast<u8>(i);
-            presentedByteCount++;
+    //Checked once at startup
+    inline const bool HAS_AVX2 = detectAvx2();
+#endif
+
+    //Exact byte histogram, added onto `frequencies`
+    inline void updateFrequency(span<const u8> data, array<u64, 256>& frequencies) noexcept {
+        constexpr u64 SLICE_SIZE = u64(1) << 30;
+        for (u64 offset = 0; offset < data.size(); offset += SLICE_SIZE) {
+            const span<const u8> slice = data.subspan(offset, std::min(SLICE_SIZE, data.size() - offset));
+            array<u32, 256 * HISTOGRAM_TABLES> counts{};
+        #if _LZIP_AVX2
+            if (HAS_AVX2) countInterleavedAvx2(slice, counts);
+            else countInterleaved(slice, counts);
+        #else
+            countInterleaved(slice, counts);
+        #endif
+            for (u32 i = 0; i < 256; i++) frequencies[i] += counts[i] + counts[256 + i] + counts[512 + i] + counts[768 + i];
         }
-        switch (presentedByteCount) {
-            case 0: return true;
-            case 1:
-                result[byteFrequencies[0].byte].code = 0;
-                result[byteFrequencies[0].byte].codeLen = 1;
-                return true;
-            default: break;
+    }
+
+    inline constexpr u64 SAMPLE_CHUNK_SIZE = 4096, SAMPLE_STRIDE = 8;
+    //Estimates the histogram from every `SAMPLE_STRIDE`th chunk of `SAMPLE_CHUNK_SIZE` bytes, scaled back up to the size of `data`
+    //Bytes the sample missed still get a count of 1, so the resulting code can encode any input but is no longer guaranteed optimal
+    inline void updateFrequencySampled(span<const u8> data, array<u64, 256>& frequencies) noexcept {
+        if (data.size() <= SAMPLE_CHUNK_SIZE * SAMPLE_STRIDE) {
+            updateFrequency(data, frequencies);
+            for (u64& frequency : frequencies) frequency += frequency == 0;
+            return;
         }
-        vector<IndexedNode> nodes;
-        nodes.reserve(static_cast<u64>(presentedByteCount) * 2);
-        for (u16 i = 0; i < presentedByteCount; i++) nodes.emplace_back(byteFrequencies[i].frequency, 0xFFFFu, 0xFFFFu, byteFrequencies[i].byte, true);
-        priority_queue<u16, vector<u16>, IndexedNodeComparator> nodePQ((IndexedNodeComparator(nodes)));
-        for (u16 i = 0; i < presentedByteCount; i++) nodePQ.push(static_cast<u16>(i));
-        //Construct the tree
-        while (nodePQ.size() > 1) {
-            u16 index1 = nodePQ.top();
-            nodePQ.pop();
-            u16 index2 = nodePQ.top();
-            nodePQ.pop();
-            IndexedNode newNode{
-                .frequency = nodes[index1].frequency + nodes[index2].frequency,
-                .left = index1,
-                .right = index2,
-                .byte = 0,
-                .isLeaf = false,
-            };
-            u16 newIndex = static_cast<u16>(nodes.size());
-            nodes.push_back(newNode);
-            nodePQ.push(newIndex);
+        array<u64, 256> sample{};
+        u64 sampledSize = 0;
+        for (u64 offset = 0; offset < data.size(); offset += SAMPLE_CHUNK_SIZE * SAMPLE_STRIDE) {
+            const span<const u8> chunk = data.subspan(offset, std::min(SAMPLE_CHUNK_SIZE, data.size() - offset));
+            updateFrequency(chunk, sample);
+            sampledSize += chunk.size();
         }
-        u16 actualMaxCodeLen = 0;
-        { //Calculate lengths
-            vector<IndexCodeLen> stack;
-            stack.push_back({nodePQ.top(), 0});
-            while (!stack.empty()) {
-                IndexCodeLen currentIndex = stack.back();
-                stack.pop_back();
-                const IndexedNode& currentNode = nodes[currentIndex.index];
-                if (currentNode.isLeaf) {
-                    result[currentNode.byte].codeLen = currentIndex.codeLen;
-                    if (currentIndex.codeLen > actualMaxCodeLen) actualMaxCodeLen = currentIndex.codeLen;
-                }
-                else {
-                    if (currentNode.left != 0xFFFFu) stack.emplace_back(currentNode.left, currentIndex.codeLen + 1);
-                    if (currentNode.right != 0xFFFFu) stack.emplace_back(currentNode.right, currentIndex.codeLen + 1);
-                }
+        for (u32 i = 0; i < 256; i++) frequencies[i] += std::max<u64>(1, sample[i] * data.size() / sampledSize);
+    }
+
+    inline constexpr u16 MAX_CODE_LEN = 24;
+
+    //Longest codes the byte coding kernels are specialized for; a table takes the first kernel that covers its longest code
+    inline constexpr u32 KERNEL_COUNT = 4;
+    inline constexpr array<u16, KERNEL_COUNT> KERNEL_CODE_LENS{8, 11, 12, MAX_CODE_LEN};
+
+    [[nodiscard]] constexpr u32 kernelIndex(u32 maxCodeLen) noexcept {
+        u32 index = 0;
+        while (index + 1 < KERNEL_COUNT && maxCodeLen > KERNEL_CODE_LENS[index]) index++;
+        return index;
+    }
+
+    //Unlimited Huffman code lengths for `count` symbols sorted by ascending frequency, returns the longest
+    //Merged nodes come out in ascending weight too, so two queues replace the priority queue: the sorted symbols and the nodes built so far
+    template <size_t N>
+    inline u16 getCodeLengths(const array<u64, N>& sortedFrequencies, u16 count, array<u16, N>& lengths) noexcept {
+        array<u64, N> nodeWeights;
+        array<u16, N> symbolParents, nodeParents;
+        u16 symbol = 0, node = 0;
+        //Symbols first on ties, which keeps the tree shallow
+        const auto takeSmallest = [&](u16 created) -> std::pair<u64, bool> {
+            if (symbol < count && (node == created || sortedFrequencies[symbol] <= nodeWeights[node])) return {sortedFrequencies[symbol++], true};
+            return {nodeWeights[node++], false};
+        };
+        for (u16 created = 0; created + 1 < count; created++) {
+            u64 weight = 0;
+            for (u32 child = 0; child < 2; child++) {
+                const auto [childWeight, isSymbol] = takeSmallest(created);
+                weight += childWeight;
+                (isSymbol ? symbolParents[symbol - 1] : nodeParents[node - 1]) = created;
             }
+            nodeWeights[created] = weight;
         }
-        vector<u16> codeLenCounts(actualMaxCodeLen + 1, 0);
-        //Count each length's occurrences
-        for (u16 i = 0; i < 256; i++) {
-            u16 temp = result[i].codeLen;
-            if (temp > 0) {
-                if (temp > actualMaxCodeLen) temp = actualMaxCodeLen;
-                codeLenCounts[temp]++;
-            }
+        //Parents are always created after their children, so depths resolve from the root down
+        array<u16, N> nodeDepths;
+        nodeDepths[count - 2] = 0;
+        for (int32_t i = count - 3; i >= 0; i--) nodeDepths[i] = static_cast<u16>(nodeDepths[nodeParents[i]] + 1);
+        u16 longest = 0;
+        for (u16 i = 0; i < count; i++) {
+            lengths[i] = static_cast<u16>(nodeDepths[symbolParents[i]] + 1);
+            longest = std::max(longest, lengths[i]);
         }
-        //Reduce lengths
-        if (actualMaxCodeLen > MAX_CODE_LEN) {
-            for (u16 i = actualMaxCodeLen; i > MAX_CODE_LEN; i--) while (codeLenCounts[i] > 0) {
-                //Move two codes from length len to one code of length len - 1
-                if (codeLenCounts[i] < 2) return false;
-                codeLenCounts[i] -= 2;
-                codeLenCounts[static_cast<size_t>(i) - 1]++;
-                u16 shallowLeafCodeLen = i - 2;
-                while (shallowLeafCodeLen > 0 && codeLenCounts[shallowLeafCodeLen] == 0) shallowLeafCodeLen--;
-                if (shallowLeafCodeLen == 0) return false;
-                codeLenCounts[shallowLeafCodeLen]--;
-                codeLenCounts[static_cast<size_t>(shallowLeafCodeLen) + 1] += 2;
+        return longest;
+    }
+
+    //Optimal code lengths limited to `maxCodeLen` by package-merge, for `count` symbols sorted by ascending frequency; `lengths` comes out in the same order
+    //Level `maxCodeLen` holds the symbols alone, every level above merges them with the pairs ("packages") of the level below, both in ascending frequency
+    //The 2 * `count` - 2 cheapest items of the top level form the code: each time a symbol is part of a chosen item, its code gets one bit longer
+    //Chosen symbols are always the cheapest ones of their level, so a level only needs to remember which of its items are symbols
+    template <size_t N>
+    inline void getLimitedCodeLengths(const array<u64, N>& sortedFrequencies, u16 count, u16 maxCodeLen, array<u16, N>& lengths) noexcept {
+        constexpr u16 MAX_ITEMS = 2 * N;
+        //A code of `count` symbols never needs more than `count` - 1 bits, so deeper levels would only repeat the last one
+        const u16 levels = std::min<u16>(maxCodeLen, count - 1);
+        //The merges below are branch-free: exhausted symbols and packages are replaced by sentinels that always lose
+        array<u64, N + 1> symbolWeights;
+        std::copy_n(sortedFrequencies.begin(), count, symbolWeights.begin());
+        symbolWeights[count] = UINT64_MAX;
+        //One bit per item of each level: set for a symbol, clear for a package
+        array<array<u64, (MAX_ITEMS + 63) / 64>, MAX_CODE_LEN + 1> isSymbol{};
+        //Levels alternate between the two halves, 2 spare entries each for the sentinel package
+        array<u64, 2 * (MAX_ITEMS + 2)> weightBuffer;
+        u64* weights = weightBuffer.data();
+        u64* previousWeights = weights + MAX_ITEMS + 2;
+        u16 previousCount = 0;
+        for (u16 level = levels; level >= 1; level--) {
+            //Merge the symbols with the packages of the level below, symbols first on ties so codes stay short
+            const u16 packages = previousCount / 2, items = count + packages;
+            previousWeights[2 * packages] = previousWeights[2 * packages + 1] = UINT64_MAX / 2;
+            u16 symbol = 0, package = 0;
+            for (u16 item = 0; item < items; item++) {
+                const u64 symbolWeight = symbolWeights[symbol], packageWeight = previousWeights[2 * package] + previousWeights[2 * package + 1];
+                const bool takeSymbol = symbolWeight <= packageWeight;
+                weights[item] = takeSymbol ? symbolWeight : packageWeight;
+                isSymbol[level][item >> 6] |= u64(takeSymbol) << (item & 63);
+                symbol += takeSymbol;
+                package += !takeSymbol;
             }
-            actualMaxCodeLen = MAX_CODE_LEN;
-            //We might end up with less than maxCodeLength after reduction, so adjust actualMaxCodeLength
-            while (codeLenCounts[actualMaxCodeLen] == 0 && actualMaxCodeLen > 0) actualMaxCodeLen--;
+            std::swap(weights, previousWeights);
+            previousCount = items;
         }
-        for (u16 i = 0; i < presentedByteCount; i++) result[byteFrequencies[i].byte].codeLen = 0;
-        sort(byteFrequencies.begin(), byteFrequencies.begin() + presentedByteCount, [](const ByteFrequency& a, const ByteFrequency& b) {
-            if (a.frequency == b.frequency) return a.byte < b.byte;
-            return a.frequency > b.frequency;
-        });
-        u8 symbolIndex = 0;
-        for (u16 i = 1; i <= actualMaxCodeLen; ++i) {
-            u16 count = codeLenCounts[i];
-            for (u16 j = 0; j < count; j++) {
-                result[byteFrequencies[symbolIndex].byte].codeLen = i;
-                symbolIndex++;
-            }
+        lengths.fill(0);
+        u16 chosen = static_cast<u16>(2 * count - 2);
+        for (u16 level = 1; level <= levels && chosen > 0; level++) {
+            u16 symbols = 0;
+            for (u16 word = 0; word < chosen >> 6; word++) symbols += static_cast<u16>(std::popcount(isSymbol[level][word]));
+            if ((chosen & 63) != 0) symbols += static_cast<u16>(std::popcount(isSymbol[level][chosen >> 6] & ((u64(1) << (chosen & 63)) - 1)));
+            for (u16 i = 0; i < symbols; i++) lengths[i]++;
+            chosen = static_cast<u16>(2 * (chosen - symbols));
         }
-        sort(byteFrequencies.begin(), byteFrequencies.begin() + presentedByteCount, [&result](const ByteFrequency& a, const ByteFrequency& b) {
-            if (result[a.byte].codeLen == result[b.byte].codeLen) return a.byte < b.byte;
-            return result[a.byte].codeLen < result[b.byte].codeLen;
-        });
-        const u8 firstByte = byteFrequencies[0].byte;
-        u16 currentLen = result[firstByte].codeLen;
-        u64 currentCode = 0;
-        result[firstByte].code = currentCode;
-        for (u16 i = 1; i < presentedByteCount; ++i) {
-            const u8 byteValue = byteFrequencies[i].byte;
-            const u16 thisLen = result[byteValue].codeLen;
-            currentCode = (currentCode + 1) << (thisLen - currentLen);
-            result[byteValue].code = currentCode;
-            currentLen = thisLen;
+    }
+
+    //Works for any alphabet of `N` symbols, codes are limited to `maxCodeLen` bits and stay optimal under that limit
+    //Allocation-free and can't fail as long as `N` symbols fit in `maxCodeLen` bits
+    template <size_t N>
+    inline void getHuffmanCode(const array<u64, N>& frequencies, array<HuffmanCode, N>& result, u16& presentedSymbolCount, u16 maxCodeLen = MAX_CODE_LEN) noexcept {
+        assert(maxCodeLen <= MAX_CODE_LEN && N <= (size_t(1) << maxCodeLen));
+        result.fill({});
+        //Frequency and symbol packed into one key sort as fast as plain integers; frequencies are bounded by the block size, far below 2^48
+        array<u64, N> keys;
+        presentedSymbolCount = 0;
+        for (u16 i = 0; i < N; i++) if (frequencies[i] > 0) {
+            assert(frequencies[i] < (u64(1) << 48));
+            keys[presentedSymbolCount++] = frequencies[i] << 16 | i;
         }
-        return true;
+        switch (presentedSymbolCount) {
+            case 0: return;
+            case 1:
+                result[static_cast<u16>(keys[0])].code = 0;
+                result[static_cast<u16>(keys[0])].codeLen = 1;
+                return;
+            default: break;
+        }
+        sort(keys.begin(), keys.begin() + presentedSymbolCount);
+        array<u64, N> sortedFrequencies;
+        for (u16 i = 0; i < presentedSymbolCount; i++) sortedFrequencies[i] = keys[i] >> 16;
+        array<u16, N> lengths;
+        //Most tables fit the limit as they are, package-merge only runs for the ones that don't
+        if (getCodeLengths(sortedFrequencies, presentedSymbolCount, lengths) > maxCodeLen) getLimitedCodeLengths(sortedFrequencies, presentedSymbolCount, maxCodeLen, lengths);
+        array<u16, MAX_CODE_LEN + 2> lengthCounts{};
+        for (u16 i = 0; i < presentedSymbolCount; i++) {
+            result[static_cast<u16>(keys[i])].codeLen = lengths[i];
+            lengthCounts[lengths[i]]++;
+        }
+        //Canonical codes: shorter codes first, ascending symbols within a length, the same order `getCanonicalCode` rebuilds
+        array<u64, MAX_CODE_LEN + 2> nextCode{};
+        for (u16 length = 1; length <= maxCodeLen; length++) nextCode[length + 1] = (nextCode[length] + lengthCounts[length]) << 1;
+        for (u16 i = 0; i < N; i++) if (result[i].codeLen > 0) result[i].code = nextCode[result[i].codeLen]++;
     }
 
     inline void serialize(const array<HuffmanCode, 256>& codes, vector<u8>& data) noexcept {
         for (u16 i = 0; i < 256; i++) data.push_back(codes[i].codeLen);
     }
 
-    inline void deserialize(const array<u8, 256>& table, vector<IndexedNodeR>& tree) noexcept {
-        tree.clear();
-        vector<ByteCodeLen> presentedBytes;
-        presentedBytes.reserve(256);
-        for (u16 i = 0; i < 256; i++) if (table[i] > 0) presentedBytes.emplace_back(static_cast<u8>(i), table[i]);
+    //Rebuilds canonical codes from a serialized length table, rejects over-subscribed tables or codes over `maxCodeLen` bits
+    template <size_t N>
+    [[nodiscard]] inline bool getCanonicalCode(const array<u8, N>& table, array<HuffmanCode, N>& result, u16 maxCodeLen = MAX_CODE_LEN) noexcept {
+        result.fill({});
+        array<SymbolCodeLen, N> presentedSymbols{};
+        u16 presentedSymbolCount = 0;
+        u64 kraftSum = 0;
+        for (u16 i = 0; i < N; i++) if (table[i] > 0) {
+            if (table[i] > maxCodeLen) return false;
+            presentedSymbols[presentedSymbolCount++] = {i, table[i]};
+            kraftSum += 1ull << (MAX_CODE_LEN - table[i]);
+        }
+        if (kraftSum > 1ull << MAX_CODE_LEN) return false;
         //Empty table
-        if (presentedBytes.size() == 0) return;
-        sort(presentedBytes.begin(), presentedBytes.end(), [](const ByteCodeLen& a, const ByteCodeLen& b) {
-            if (a.codeLen == b.codeLen) return a.byte < b.byte;
+        if (presentedSymbolCount == 0) return true;
+        sort(presentedSymbols.begin(), presentedSymbols.begin() + presentedSymbolCount, [](const SymbolCodeLen& a, const SymbolCodeLen& b) {
+            if (a.codeLen == b.codeLen) return a.symbol < b.symbol;
             return a.codeLen < b.codeLen;
         });
-        tree.emplace_back(); //Root
         u64 currentCode = 0;
-        u8 currentLen = presentedBytes[0].codeLen;
-        for (u16 i = 0; i < presentedBytes.size(); i++) {
-            u8 thisLen = presentedBytes[i].codeLen;
+        u8 currentLen = presentedSymbols[0].codeLen;
+        for (u16 i = 0; i < presentedSymbolCount; i++) {
+            const u8 thisLen = presentedSymbols[i].codeLen;
             if (i > 0) {
                 currentCode = (currentCode + 1u) << (thisLen - currentLen);
                 currentLen = thisLen;
             }
-            u16 nodeIndex = 0;
-            for (i16 bitPos = static_cast<i16>(thisLen) - 1; bitPos >= 0; bitPos--) {
-                u64 bit = (currentCode >> bitPos) & 1u;
-                u16 nextIndex;
-                if (bit) {
-                    if (tree[nodeIndex].right == 0xFFFFu) {
-                        nextIndex = static_cast<u16>(tree.size());
-                        tree[nodeIndex].right = nextIndex;
-                        IndexedNodeR newNode;
-                        tree.push_back(newNode);
-                    }
-                    else nextIndex = tree[nodeIndex].right;
-                }
-                else {
-                    if (tree[nodeIndex].left == 0xFFFFu) {
-                        nextIndex = static_cast<u16>(tree.size());
-                        tree[nodeIndex].left = nextIndex;
-                        IndexedNodeR newNode;
-                        tree.push_back(newNode);
-                    }
-                    else nextIndex = tree[nodeIndex].left;
-                }
-                nodeIndex = nextIndex;
-            }
-            IndexedNodeR& leaf = tree[nodeIndex];
-            leaf.isLeaf = true;
-            leaf.byte = presentedBytes[i].byte;
+            result[presentedSymbols[i].symbol].code = currentCode;
+            result[presentedSymbols[i].symbol].codeLen = thisLen;
         }
+        return true;
     }
 
-    inline void getCodeMap(const vector<IndexedNodeR>& tree, array<HuffmanCode, 256>& result) noexcept {
-        result.fill({});
-        if (tree.empty()) return;
-        vector<IndexCodeCodeLen> stack;
-        stack.emplace_back(0, 0, 0);
-        while (!stack.empty()) {
-            IndexCodeCodeLen current = stack.back();
-            stack.pop_back();
-            const IndexedNodeR& currentNode = tree[current.index];
-            if (currentNode.isLeaf) {
-                result[currentNode.byte].code = current.code;
-                result[currentNode.byte].codeLen = current.codeLen == 0 ? 1 : current.codeLen;
+    inline constexpr u8 DECODE_TABLE_BITS = 11;
+    inline constexpr u32 DECODE_TABLE_SIZE = 1u << DECODE_TABLE_BITS;
+    //Marks a bit pattern no code starts with, it never fits in the bit buffer so decoding just stops there
+    inline constexpr u8 INVALID_ENTRY_LEN = 0xFFu;
+
+    //`count` is 1 or 2 for leaves (`payload` holds the symbol, or two bytes with the first in the low byte, `firstLength` the first code's length when there are two), 0 for links into `secondary` (`payload` holds the offset and `length` the index width)
+    struct DecodeEntry {
+        u32 payload : 18;
+        u32 firstLength : 4;
+        u32 count : 2;
+        u32 length : 8;
+    };
+
+    struct DecodeTable {
+        array<DecodeEntry, DECODE_TABLE_SIZE> primary{};
+        vector<DecodeEntry> secondary;
+        //Picks the decoding kernel, tables whose codes all fit `DECODE_TABLE_BITS` never use `secondary`
+        u16 maxCodeLen{0};
+    };
+
+    //Codes up to `DECODE_TABLE_BITS` long resolve in one probe (two bytes at once if both fit and `pairSymbols` is set), longer ones go through a per-prefix second-level table
+    template <size_t N>
+    [[nodiscard]] inline bool buildDecodeTable(const array<HuffmanCode, N>& codes, DecodeTable& table, bool pairSymbols = N == 256) noexcept {
+        constexpr DecodeEntry invalidEntry{0, 0, 1, INVALID_ENTRY_LEN};
+        table.primary.fill(invalidEntry);
+        table.secondary.clear();
+        table.maxCodeLen = 0;
+        u16 presentedSymbolCount = 0;
+        u64 kraftSum = 0;
+        for (u16 i = 0; i < N; i++) if (codes[i].codeLen > 0) {
+            if (codes[i].codeLen > MAX_CODE_LEN) return false;
+            table.maxCodeLen = std::max(table.maxCodeLen, codes[i].codeLen);
+            presentedSymbolCount++;
+            kraftSum += 1ull << (MAX_CODE_LEN - codes[i].codeLen);
+        }
+        //Only complete codes are produced by `getHuffmanCode`, a lone symbol gets a single 1-bit code
+        if (presentedSymbolCount > 1 && kraftSum != 1ull << MAX_CODE_LEN) return false;
+        array<u8, DECODE_TABLE_SIZE> subTableBits{};
+        for (u16 i = 0; i < N; i++) {
+            const u16 len = codes[i].codeLen;
+            if (len == 0) continue;
+            if (len <= DECODE_TABLE_BITS) {
+                const u32 first = static_cast<u32>(codes[i].code << (DECODE_TABLE_BITS - len)), count = 1u << (DECODE_TABLE_BITS - len);
+                for (u32 j = 0; j < count; j++) table.primary[first + j] = {static_cast<u32>(i), 0, 1, static_cast<u32>(len)};
             }
             else {
-                if (currentNode.left != 0xFFFFu) stack.emplace_back(current.code << 1, currentNode.left, current.codeLen + 1);
-                if (currentNode.right != 0xFFFFu) stack.emplace_back((current.code << 1) | 1u, currentNode.right, current.codeLen + 1);
+                u8& bits = subTableBits[codes[i].code >> (len - DECODE_TABLE_BITS)];
+                if (len - DECODE_TABLE_BITS > bits) bits = static_cast<u8>(len - DECODE_TABLE_BITS);
             }
         }
+        u32 secondarySize = 0;
+        for (u32 i = 0; i < DECODE_TABLE_SIZE; i++) if (subTableBits[i] > 0) {
+            table.primary[i] = {secondarySize, 0, 0, subTableBits[i]};
+            secondarySize += 1u << subTableBits[i];
+        }
+        table.secondary.assign(secondarySize, invalidEntry);
+        for (u16 i = 0; i < N; i++) {
+            const u16 len = codes[i].codeLen;
+            if (len <= DECODE_TABLE_BITS) continue;
+            const DecodeEntry& link = table.primary[codes[i].code >> (len - DECODE_TABLE_BITS)];
+            const u32 suffixLen = len - DECODE_TABLE_BITS, suffix = static_cast<u32>(codes[i].code & ((1u << suffixLen) - 1));
+            const u32 first = link.payload + (suffix << (link.length - suffixLen)), count = 1u << (link.length - suffixLen);
+            for (u32 j = 0; j < count; j++) table.secondary[first + j] = {static_cast<u32>(i), 0, 1, static_cast<u32>(len)};
+        }
+        //Pair up short codes whose successor also fits in the remaining index bits, only byte alphabets fit two symbols in `payload`
+        if (!pairSymbols || N > 256) return true;
+        const array<DecodeEntry, DECODE_TABLE_SIZE> singles = table.primary;
+        for (u32 i = 0; i < DECODE_TABLE_SIZE; i++) {
+            const DecodeEntry first = singles[i];
+            if (first.count != 1 || first.length >= DECODE_TABLE_BITS) continue;
+            const DecodeEntry second = singles[(i << first.length) & (DECODE_TABLE_SIZE - 1)];
+            if (second.count != 1 || second.length > DECODE_TABLE_BITS - first.length) continue;
+            table.primary[i] = {static_cast<u32>(first.payload | (second.payload << 8)), first.length, 2, static_cast<u32>(first.length + second.length)};
+        }
+        return true;
     }
 }
\ No newline at end of file
@@ -0,0 +1,236 @@
+﻿#pragma once
+#include <array>
+#include <bit>
+#include <cstring>
+#include <span>
+#include <vector>
+
+#include "huffman.hpp"
+
+//Match finding and the symbol alphabets for LZ77 blocks:
+//  literal/length symbols: 0-255 are literal bytes, 256 and up are match lengths followed by extra bits
+//  distance symbols: two per power of two, followed by extra bits
+namespace Lzip::Lz77 {
+    typedef uint8_t u8;
+    typedef uint16_t u16;
+    typedef uint32_t u32;
+    typedef uint64_t u64;
+    using std::array, std::span, std::vector, std::endian;
+
+    inline constexpr u32 MIN_MATCH = 3, MAX_MATCH = 258;
+    //A shortest match further back than this costs more bits than its literals
+    inline constexpr u32 MIN_MATCH_MAX_DISTANCE = 4096;
+    //Positions are hashed by their first four bytes, which keeps chains to candidates likely to beat three literals
+    inline constexpr u32 HASH_BYTES = 4;
+    inline constexpr u32 LITERAL_SYMBOLS = 256, LENGTH_SYMBOLS = 29, LITLEN_SYMBOLS = LITERAL_SYMBOLS + LENGTH_SYMBOLS, DISTANCE_SYMBOLS = 48;
+    //Distances go up to `1 << MAX_WINDOW_LOG`, which covers the largest block
+    inline constexpr u32 MIN_WINDOW_LOG = 10, MAX_WINDOW_LOG = 24;
+    //Short enough that a code plus its extra bits always fits in a refilled bit buffer
+    inline constexpr u16 MAX_CODE_LEN = 15;
+
+    inline constexpr array<u16, LENGTH_SYMBOLS> LENGTH_BASE{3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+    inline constexpr array<u8, LENGTH_SYMBOLS> LENGTH_EXTRA{0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+
+    //Length symbol (without the literal offset) for every match length
+    inline constexpr array<u8, MAX_MATCH + 1> LENGTH_CODE = []() {
+        array<u8, MAX_MATCH + 1> codes{};
+        for (u32 code = 0; code < LENGTH_SYMBOLS; code++) for (u32 length = LENGTH_BASE[code]; length < LENGTH_BASE[code] + (1u << LENGTH_EXTRA[code]) && length <= MAX_MATCH; length++) codes[length] = static_cast<u8>(code);
+        //258 has a symbol of its own rather than being the last value of the one before
+        codes[MAX_MATCH] = LENGTH_SYMBOLS - 1;
+        return codes;
+    }();
+
+    [[nodiscard]] constexpr u32 distanceExtra(u32 code) noexcept { return code < 4 ? 0 : (code >> 1) - 1; }
+    [[nodiscard]] constexpr u32 distanceBase(u32 code) noexcept { return code < 4 ? code + 1 : ((2 + (code & 1)) << distanceExtra(code)) + 1; }
+
+    [[nodiscard]] inline u32 distanceCode(u32 distance) noexcept {
+        const u32 value = distance - 1;
+        if (value < 4) return value;
+        const u32 topBit = static_cast<u32>(std::bit_width(value)) - 1;
+        return topBit * 2 + ((value >> (topBit - 1)) & 1);
+    }
+
+    //A run of `literalCount` literals followed by a match, the last sequence of a block may have no match (`matchLength` 0)
+    struct Sequence {
+        u32 literalCount{0}, matchLength{0}, distance{0};
+    };
+
+    //How hard each level searches, level 0 skips LZ77 entirely; the same trade-offs as zlib's levels
+    struct Level {
+        //Candidates checked per position
+        u32 maxChain{0};
+        //Lazy levels search only a quarter of the chain one byte ahead of a match this long
+        u32 goodLength{0};
+        //Lazy levels don't look ahead of a match this long, greedy ones don't index the positions inside it
+        u32 lazyLength{0};
+        //A match this long ends the search
+        u32 niceLength{0};
+        //Looks one byte ahead before taking a match
+        bool lazy{false};
+    };
+
+    inline constexpr u32 MAX_LEVEL = 9, DEFAULT_LEVEL = 6;
+    inline constexpr array<Level, MAX_LEVEL + 1> LEVELS{{
+        {0, 0, 0, 0, false},
+        {4, 4, 4, 8, false},
+        {8, 4, 5, 16, false},
+        {32, 4, 6, 32, false},
+        {16, 4, 4, 16, true},
+        {32, 8, 16, 32, true},
+        {128, 8, 16, 128, true},
+        {256, 8, 32, 128, true},
+        {1024, 32, 128, MAX_MATCH, true},
+        {4096, 32, MAX_MATCH, MAX_MATCH, true},
+    }};
+
+    //Length of the common prefix of `a` and `b`, `b` is the later position and `end` bounds it
+    [[nodiscard]] inline u32 commonLength(const u8* a, const u8* b, const u8* end) noexcept {
+        const u8* start = b;
+        while (b + 8 <= end) {
+            u64 x, y;
+            memcpy(&x, a, 8);
+            memcpy(&y, b, 8);
+            if (const u64 diff = x ^ y; diff != 0) {
+                if constexpr (endian::native == endian::little) return static_cast<u32>(b - start) + static_cast<u32>(std::countr_zero(diff) >> 3);
+                else return static_cast<u32>(b - start) + static_cast<u32>(std::countl_zero(diff) >> 3);
+            }
+            a += 8;
+            b += 8;
+        }
+        while (b < end && *a == *b) {
+            a++;
+            b++;
+        }
+        return static_cast<u32>(b - start);
+    }
+
+    //Hash chains over a sliding window: `head` holds the latest position per hash, `previous` the one before it with the same hash
+    struct MatchFinder {
+        static constexpr u32 HASH_LOG = 16, NONE = ~0u;
+        vector<u32> head, previous;
+        u32 windowSize{0};
+
+        //Keeps the capacity of earlier blocks; stale `previous` entries are never read, as chains only start from positions this block inserted
+        void reset(u32 windowLog) noexcept {
+            windowSize = 1u << windowLog;
+            head.assign(1u << HASH_LOG, NONE);
+            previous.resize(windowSize);
+        }
+
+        //Needs `HASH_BYTES` readable bytes at `data`
+        [[nodiscard]] static u32 hash(const u8* data) noexcept {
+            u32 value;
+            memcpy(&value, data, HASH_BYTES);
+            return (value * 2654435761u) >> (32 - HASH_LOG);
+        }
+
+        void insert(const u8* input, u32 position) noexcept {
+            u32& latest = head[hash(input + position)];
+            previous[position & (windowSize - 1)] = latest;
+            latest = position;
+        }
+
+        //Longest match for `position` among the earlier positions with the same hash, checking at most `maxChain` of them; `length` stays below `MIN_MATCH` when there is none
+        void find(span<const u8> input, u32 position, const Level& level, u32 maxChain, u32& length, u32& distance) const noexcept {
+            length = MIN_MATCH - 1;
+            const u32 limit = position > windowSize ? position - windowSize : 0, maxLength = std::min<u32>(MAX_MATCH, static_cast<u32>(input.size()) - position);
+            if (maxLength < MIN_MATCH) return;
+            const u8* current = input.data() + position;
+            u32 candidate = head[hash(current)];
+            for (u32 chain = maxChain; chain > 0 && candidate != NONE && candidate >= limit && candidate < position; chain--) {
+                //Checking the byte that would extend the best match first rejects most candidates at once
+                if (input[candidate + length] == current[length]) {
+                    const u32 candidateLength = commonLength(input.data() + candidate, current, current + maxLength);
+                    if (candidateLength > length && (candidateLength > MIN_MATCH || position - candidate <= MIN_MATCH_MAX_DISTANCE)) {
+                        length = candidateLength;
+                        distance = position - candidate;
+                        if (length >= level.niceLength || length == maxLength) return;
+                    }
+                }
+                const u32 next = previous[candidate & (windowSize - 1)];
+                //The slot was reused by a newer position, the rest of the chain is gone
+                if (next >= candidate && next != NONE) return;
+                candidate = next;
+            }
+        }
+    };
+
+    //Both tables as one nibble per code length, literal/length first
+    inline void serialize(const array<Huffman::HuffmanCode, LITLEN_SYMBOLS>& litlenCodes, const array<Huffman::HuffmanCode, DISTANCE_SYMBOLS>& distanceCodes, vector<u8>& data) noexcept {
+        array<u8, LITLEN_SYMBOLS + DISTANCE_SYMBOLS + 1> lengths{};
+        for (u32 i = 0; i < LITLEN_SYMBOLS; i++) lengths[i] = static_cast<u8>(litlenCodes[i].codeLen);
+        for (u32 i = 0; i < DISTANCE_SYMBOLS; i++) lengths[LITLEN_SYMBOLS + i] = static_cast<u8>(distanceCodes[i].codeLen);
+        for (u32 i = 0; i + 1 < lengths.size(); i += 2) data.push_back(static_cast<u8>(lengths[i] << 4 | lengths[i + 1]));
+    }
+
+    inline void deserialize(span<const u8> table, array<u8, LITLEN_SYMBOLS>& litlenLengths, array<u8, DISTANCE_SYMBOLS>& distanceLengths) noexcept {
+        for (u32 i = 0; i < LITLEN_SYMBOLS + DISTANCE_SYMBOLS; i++) {
+            const u8 length = (i & 1) ? table[i >> 1] & 0xF : table[i >> 1] >> 4;
+            if (i < LITLEN_SYMBOLS) litlenLengths[i] = length;
+            else distanceLengths[i - LITLEN_SYMBOLS] = length;
+        }
+    }
+
+    //Cheap look for repeats in a block whose bytes are spread too evenly for entropy coding alone:
+    //a few slices are hashed with a one-entry-per-bucket table, and a block is worth parsing once enough positions repeat the 4 bytes last seen in their bucket
+    [[nodiscard]] inline bool hasRepeats(span<const u8> input) noexcept {
+        constexpr u32 SLICES = 4, SLICE_SIZE = 16384, PROBE_HASH_LOG = 12;
+        //Random bytes fill 4096 buckets by chance far less often than this
+        constexpr u32 MIN_HITS = SLICE_SIZE / 32;
+        if (input.size() < HASH_BYTES) return false;
+        array<u32, 1u << PROBE_HASH_LOG> last;
+        u32 hits = 0, probed = 0;
+        const u64 sliceStride = input.size() / SLICES;
+        for (u32 slice = 0; slice < SLICES; slice++) {
+            const u64 start = slice * sliceStride, end = std::min<u64>(start + SLICE_SIZE, input.size() - HASH_BYTES + 1);
+            last.fill(0);
+            for (u64 position = start; position < end; position++) {
+                u32 value;
+                memcpy(&value, input.data() + position, HASH_BYTES);
+                u32& bucket = last[(value * 2654435761u) >> (32 - PROBE_HASH_LOG)];
+                //The first occurrence of a zero word counts as a repeat, which doesn't matter at this threshold
+                hits += bucket == value;
+                bucket = value;
+            }
+            probed += static_cast<u32>(end > start ? end - start : 0);
+        }
+        return hits * SLICE_SIZE >= static_cast<u64>(MIN_HITS) * probed;
+    }
+
+    //Greedy or lazy parse of `input` into `sequences`, every position is added to the hash chains
+    inline void parse(span<const u8> input, const Level& level, MatchFinder& finder, vector<Sequence>& sequences) noexcept {
+        sequences.clear();
+        const u32 size = static_cast<u32>(input.size());
+        if (size < HASH_BYTES) {
+            if (size > 0) sequences.push_back({size, 0, 0});
+            return;
+        }
+        const u32 lastHashable = size - HASH_BYTES;
+        u32 position = 0, literalStart = 0;
+        while (position <= lastHashable) {
+            u32 length, distance = 0;
+            finder.find(input, position, level, level.maxChain, length, distance);
+            finder.insert(input.data(), position);
+            if (length < MIN_MATCH) {
+                position++;
+                continue;
+            }
+            //A longer match one byte later is worth a literal
+            while (level.lazy && length < level.lazyLength && position + 1 <= lastHashable) {
+                u32 nextLength, nextDistance = 0;
+                finder.find(input, position + 1, level, length >= level.goodLength ? level.maxChain >> 2 : level.maxChain, nextLength, nextDistance);
+                if (nextLength <= length) break;
+                finder.insert(input.data(), position + 1);
+                position++;
+                length = nextLength;
+                distance = nextDistance;
+            }
+            sequences.push_back({position - literalStart, length, distance});
+            const u32 end = position + length;
+            if (level.lazy || length <= level.lazyLength) for (position++; position < end && position <= lastHashable; position++) finder.insert(input.data(), position);
+            position = end;
+            literalStart = end;
+        }
+        if (literalStart < size) sequences.push_back({size - literalStart, 0, 0});
+    }
+}
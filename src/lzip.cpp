@@ -0,0 +1,261 @@
+﻿#include <algorithm>
+#include <cstring>
+#include <span>
+#include <vector>
+
+#include "compress.hpp"
+#include "container.hpp"
+#include "decompress.hpp"
+#include "lzip.hpp"
+#include "meta.hpp"
+#include "preset.hpp"
+#include "utils.hpp"
+
+namespace Lzip {
+    using std::span, std::vector, Container::BlockType, Container::BlockHeader, Container::BlockInfo, Container::Footer;
+
+    const char* statusMessage(Status status) noexcept {
+        switch (status) {
+            case Status::Ok: return "没有错误。";
+            case Status::InvalidData: return "输入数据不是有效的 Lzip 数据流。";
+            case Status::UnsupportedVersion: return "只支持分块格式（版本 2 及以上）的数据流。";
+            case Status::OutputTooSmall: return "输出缓冲区太小。";
+            case Status::ChecksumMismatch: return "校验和不匹配，数据已损坏。";
+            case Status::MissingPreset: return "数据流用到了尚未加载的预设表。";
+            default: return "未知错误。";
+        }
+    }
+
+    Encoder::Encoder(const CompressOptions& options) noexcept : options(options) {}
+
+    u64 Encoder::compressBound(u64 size, u64 blockSize) noexcept {
+        const u64 blocks = (size + blockSize - 1) / blockSize;
+        //A block no coder shrinks is stored, which only adds its header
+        return Container::FILE_HEADER_SIZE + size + blocks * (Container::BLOCK_HEADER_SIZE + Container::INDEX_ENTRY_SIZE) + 1 + Container::FOOTER_SIZE;
+    }
+
+    void Encoder::compress(span<const u8> input, vector<u8>& output) noexcept {
+        reset();
+        update(input, output);
+        finish(output);
+    }
+
+    Status Encoder::compress(span<const u8> input, span<u8> output, u64& written) noexcept {
+        reset();
+        written = 0;
+        //A block at a time goes through `scratch`, so it never holds more than one
+        const auto flush = [this, output, &written] {
+            if (scratch.size() > output.size() - written) return false;
+            std::memcpy(output.data() + written, scratch.data(), scratch.size());
+            written += scratch.size();
+            scratch.clear();
+            return true;
+        };
+        scratch.clear();
+        Container::writeFileHeader(scratch, static_cast<u32>(options.blockSize), Container::streamVersion(options.preset));
+        offset = Container::FILE_HEADER_SIZE;
+        bool fits = flush();
+        for (; fits && !input.empty(); input = input.subspan(std::min<u64>(input.size(), options.blockSize))) {
+            encodeBlock(input.first(std::min<u64>(input.size(), options.blockSize)), scratch);
+            fits = flush();
+        }
+        if (fits) {
+            Container::writeIndex(scratch, index, offset, originalSize);
+            fits = flush();
+        }
+        reset();
+        return fits ? Status::Ok : Status::OutputTooSmall;
+    }
+
+    void Encoder::update(span<const u8> input, vector<u8>& output) noexcept {
+        if (!started) {
+            Container::writeFileHeader(output, static_cast<u32>(options.blockSize), Container::streamVersion(options.preset));
+            offset = Container::FILE_HEADER_SIZE;
+            started = true;
+        }
+        //Tops up the pending block first, whole blocks are then coded straight from `input`
+        if (!pending.empty()) {
+            const u64 count = std::min<u64>(options.blockSize - pending.size(), input.size());
+            pending.insert(pending.end(), input.begin(), input.begin() + static_cast<std::ptrdiff_t>(count));
+            input = input.subspan(count);
+            if (pending.size() < options.blockSize) return;
+            encodeBlock(pending, output);
+            pending.clear();
+        }
+        for (; input.size() >= options.blockSize; input = input.subspan(options.blockSize)) encodeBlock(input.first(options.blockSize), output);
+        pending.assign(input.begin(), input.end());
+    }
+
+    void Encoder::flush(vector<u8>& output) noexcept {
+        update({}, output);
+        if (pending.empty()) return;
+        encodeBlock(pending, output);
+        pending.clear();
+    }
+
+    void Encoder::finish(vector<u8>& output) noexcept {
+        flush(output);
+        Container::writeIndex(output, index, offset, originalSize);
+        reset();
+    }
+
+    void Encoder::reset() noexcept {
+        pending.clear();
+        index.clear();
+        offset = 0;
+        originalSize = 0;
+        started = false;
+    }
+
+    void Encoder::encodeBlock(span<const u8> input, vector<u8>& output) noexcept {
+        const u64 blockStart = output.size();
+        const u32 checksum = Checksum::crc32c(input);
+        compressBlock(input, output, options);
+        const u64 size = output.size() - blockStart;
+        index.emplace_back(offset, static_cast<u32>(input.size()), static_cast<u32>(size), checksum);
+        offset += size;
+        originalSize += input.size();
+    }
+
+    Status Decoder::originalSize(span<const u8> input, u64& size) noexcept {
+        Decoder decoder;
+        Footer footer;
+        const Status status = decoder.readIndex(input, footer);
+        if (status == Status::Ok) size = footer.originalSize;
+        return status;
+    }
+
+    Status Decoder::decompress(span<const u8> input, vector<u8>& output) noexcept {
+        Footer footer;
+        if (const Status status = readIndex(input, footer); status != Status::Ok) return status;
+        const u64 start = output.size();
+        output.resize(start + footer.originalSize);
+        const Status status = decodeBlocks(input, span<u8>(output).subspan(start));
+        if (status != Status::Ok) output.resize(start);
+        return status;
+    }
+
+    Status Decoder::decompress(span<const u8> input, span<u8> output, u64& written) noexcept {
+        written = 0;
+        Footer footer;
+        if (const Status status = readIndex(input, footer); status != Status::Ok) return status;
+        if (footer.originalSize > output.size()) return Status::OutputTooSmall;
+        if (const Status status = decodeBlocks(input, output.first(footer.originalSize)); status != Status::Ok) return status;
+        written = footer.originalSize;
+        return Status::Ok;
+    }
+
+    Status Decoder::update(span<const u8> input, vector<u8>& output) noexcept {
+        if (stage == Stage::Failed) return Status::InvalidData;
+        pending.insert(pending.end(), input.begin(), input.end());
+        while (true) {
+            const span<const u8> data = span<const u8>(pending).subspan(position);
+            if (stage == Stage::Header) {
+                if (data.size() < Container::FILE_HEADER_SIZE) break;
+                if (!Container::isMagic(data.data())) return fail();
+                version = Util::readIntLE<u32>(data.data() + 4);
+                if (!Container::isBlockVersion(version)) {
+                    stage = Stage::Failed;
+                    return Status::UnsupportedVersion;
+                }
+                maxBlockSize = Util::readIntLE<u32>(data.data() + 8);
+                position += Container::FILE_HEADER_SIZE;
+                offset = Container::FILE_HEADER_SIZE;
+                stage = Stage::Blocks;
+                continue;
+            }
+            if (stage != Stage::Blocks || data.empty()) break;
+            if (data[0] == static_cast<u8>(BlockType::Index)) {
+                stage = Stage::Index;
+                break;
+            }
+            if (data.size() < Container::BLOCK_HEADER_SIZE) break;
+            const BlockHeader header = Container::readBlockHeader(data.data());
+            if (header.originalSize == 0 || header.originalSize > maxBlockSize || header.payloadSize > Container::maxPayloadSize(header.originalSize)) return fail();
+            const u64 size = Container::BLOCK_HEADER_SIZE + Container::tableSize(header.type) + header.payloadSize;
+            if (data.size() < size) break;
+            const u64 start = output.size();
+            output.resize(start + header.originalSize);
+            const span<u8> decoded = span<u8>(output).subspan(start);
+            if (!decompressBlock(data.first(size), decoded)) {
+                output.resize(start);
+                return failBlock(data.first(size));
+            }
+            //Checked against the index in `finish`, which only arrives at the end
+            blocks.emplace_back(offset, header.originalSize, static_cast<u32>(size), Container::hasChecksums(version) ? Checksum::crc32c(decoded) : 0);
+            offset += size;
+            position += size;
+        }
+        //Parsed bytes are dropped once per call rather than once per block, from the index on everything is kept
+        pending.erase(pending.begin(), pending.begin() + static_cast<std::ptrdiff_t>(position));
+        position = 0;
+        return Status::Ok;
+    }
+
+    Status Decoder::finish() noexcept {
+        //`pending` starts at the index marker, the index and footer must describe exactly the blocks seen
+        Footer footer;
+        const u64 footerSize = Container::footerSize(version);
+        const bool valid = stage == Stage::Index && pending.size() >= 1 + footerSize &&
+            Container::readFooter(pending.data() + pending.size() - footerSize, offset + pending.size(), version, footer) && footer.indexOffset == offset &&
+            Container::readIndex(pending, footer, maxBlockSize, index);
+        const Status status = !valid ? Status::InvalidData : index == blocks ? Status::Ok : Container::sameLayout(index, blocks) ? Status::ChecksumMismatch : Status::InvalidData;
+        reset();
+        return status;
+    }
+
+    void Decoder::reset() noexcept {
+        stage = Stage::Header;
+        version = 0;
+        pending.clear();
+        position = 0;
+        blocks.clear();
+        offset = 0;
+        maxBlockSize = 0;
+    }
+
+    Status Decoder::fail() noexcept {
+        stage = Stage::Failed;
+        return Status::InvalidData;
+    }
+
+    Status Decoder::failBlock(span<const u8> block) noexcept {
+        missingPresetId = unknownPreset(block);
+        if (missingPresetId == 0) return fail();
+        stage = Stage::Failed;
+        return Status::MissingPreset;
+    }
+
+    //The footer and index are checked before anything is allocated for the original data
+    Status Decoder::readIndex(span<const u8> input, Footer& footer) noexcept {
+        if (input.size() < Container::FILE_HEADER_SIZE || !Container::isMagic(input.data())) return Status::InvalidData;
+        version = Util::readIntLE<u32>(input.data() + 4);
+        if (!Container::isBlockVersion(version)) return Status::UnsupportedVersion;
+        const u32 streamMaxBlockSize = Util::readIntLE<u32>(input.data() + 8);
+        const u64 footerSize = Container::footerSize(version);
+        if (input.size() < Container::FILE_HEADER_SIZE + 1 + footerSize || !Container::readFooter(input.data() + input.size() - footerSize, input.size(), version, footer) ||
+            !Container::readIndex(input.subspan(footer.indexOffset), footer, streamMaxBlockSize, index)) return Status::InvalidData;
+        return Status::Ok;
+    }
+
+    //`output` is exactly the original size, every block is decoded straight into its part and checked while it's in cache
+    Status Decoder::decodeBlocks(span<const u8> input, span<u8> output) noexcept {
+        u64 written = 0;
+        for (const BlockInfo& block : index) {
+            const span<u8> decoded = output.subspan(written, block.originalSize);
+            if (!decompressBlock(input.subspan(block.offset, block.size), decoded)) {
+                missingPresetId = unknownPreset(input.subspan(block.offset, block.size));
+                return missingPresetId != 0 ? Status::MissingPreset : Status::InvalidData;
+            }
+            if (Container::hasChecksums(version) && Checksum::crc32c(decoded) != block.checksum) return Status::ChecksumMismatch;
+            written += block.originalSize;
+        }
+        return Status::Ok;
+    }
+
+    u32 builtinPreset(const string& name) noexcept { return Preset::builtinId(name); }
+
+    string lastError() noexcept { return Util::getLastError(); }
+
+    void setVerbose(bool verbose) noexcept { Util::verbose = verbose; }
+}
@@ -0,0 +1,142 @@
+﻿#pragma once
+#include <cstdint>
+#include <span>
+#include <string>
+#include <vector>
+
+#include "container.hpp"
+#include "options.hpp"
+
+//What liblzip offers its users, the CLI included:
+//  `Encoder` and `Decoder` turn buffers into version 3 streams, 4 with a preset, and back on the calling thread, whole or piece by piece
+//  `compressFile`, `compressFiles`, `decompressFile`, `testFile` and `extractFile` work on paths and spread blocks over a thread pool
+//Contexts keep their buffers between calls and share nothing, so each thread should have its own and reuse it
+namespace Lzip {
+    typedef uint8_t u8;
+    typedef uint32_t u32;
+    typedef uint64_t u64;
+    using std::span, std::string, std::vector;
+
+    enum class Status : u8 {
+        Ok,
+        //Not a Lzip stream, or one that is damaged or cut short
+        InvalidData,
+        //Version 1 streams are only read from files
+        UnsupportedVersion,
+        //The caller's buffer can't hold the result, nothing useful was written to it
+        OutputTooSmall,
+        //The stream is well formed but decoded to something other than what its CRCs describe
+        ChecksumMismatch,
+        //Blocks name a trained preset table that hasn't been loaded, `Decoder::missingPreset` tells which
+        MissingPreset,
+    };
+
+    [[nodiscard]] const char* statusMessage(Status status) noexcept;
+
+    //Single-threaded, blocks are coded one after another with the same choices `compressFile` makes; `threads`, `maxInFlight`, `stats` and `progress` don't apply
+    class Encoder {
+    public:
+        [[nodiscard]] explicit Encoder(const CompressOptions& options = {}) noexcept;
+
+        //Most bytes a `size`-byte input can turn into with `blockSize`, for sizing caller buffers
+        [[nodiscard]] static u64 compressBound(u64 size, u64 blockSize = Container::DEFAULT_BLOCK_SIZE) noexcept;
+
+        //Appends a whole stream for `input`, dropping any stream `update` had started
+        void compress(span<const u8> input, vector<u8>& output) noexcept;
+        //Writes a whole stream to the start of `output`, `written` is its size
+        [[nodiscard]] Status compress(span<const u8> input, span<u8> output, u64& written) noexcept;
+
+        //Appends the header on the first call of a stream, then every block `input` completes; bytes short of a block wait for the next call
+        void update(span<const u8> input, vector<u8>& output) noexcept;
+        //Appends the bytes waiting for a full block as a short block of their own, so a `Decoder` fed `output` gets everything passed to `update` so far
+        //Every block starts on a byte boundary with its own tables, frames are only as cheap as the coders make a block of their size
+        void flush(vector<u8>& output) noexcept;
+        //Appends what's left, the index and the footer, and starts the next stream
+        void finish(vector<u8>& output) noexcept;
+        //Drops a stream in progress, the next `update` starts over
+        void reset() noexcept;
+
+    private:
+        void encodeBlock(span<const u8> input, vector<u8>& output) noexcept;
+
+        CompressOptions options;
+        //Input waiting for a full block, and blocks on their way into a caller's buffer
+        vector<u8> pending, scratch;
+        vector<Container::BlockInfo> index;
+        //Stream offset of the next block, and input coded so far
+        u64 offset{0}, originalSize{0};
+        bool started{false};
+    };
+
+    //Reads version 2 to 4 streams on the calling thread, checking the CRCs of version 3 and 4 ones
+    class Decoder {
+    public:
+        //From the footer, so a caller can size its buffer before `decompress`
+        [[nodiscard]] static Status originalSize(span<const u8> input, u64& size) noexcept;
+
+        //Appends the original data of the whole stream `input`
+        [[nodiscard]] Status decompress(span<const u8> input, vector<u8>& output) noexcept;
+        //Writes the original data to the start of `output`, `written` is its size
+        [[nodiscard]] Status decompress(span<const u8> input, span<u8> output, u64& written) noexcept;
+
+        //Appends every block `input` completes, keeping partial blocks until the rest arrives
+        [[nodiscard]] Status update(span<const u8> input, vector<u8>& output) noexcept;
+        //Checks that the index and footer arrived and describe the blocks decoded, CRCs included, then starts the next stream
+        [[nodiscard]] Status finish() noexcept;
+        void reset() noexcept;
+        //ID of the table behind the last `Status::MissingPreset`, so the caller can `loadPreset` the right file
+        [[nodiscard]] u32 missingPreset() const noexcept { return missingPresetId; }
+
+    private:
+        enum class Stage : u8 {
+            Header,
+            Blocks,
+            //Everything from the index marker on is kept for `finish`
+            Index,
+            //Sticky until `reset`, a stream that went wrong once can't recover
+            Failed,
+        };
+
+        [[nodiscard]] Status fail() noexcept;
+        //`Status::MissingPreset` when `block` names a table this process lacks, otherwise what `fail` says
+        [[nodiscard]] Status failBlock(span<const u8> block) noexcept;
+        [[nodiscard]] Status readIndex(span<const u8> input, Container::Footer& footer) noexcept;
+        [[nodiscard]] Status decodeBlocks(span<const u8> input, span<u8> output) noexcept;
+
+        Stage stage{Stage::Header};
+        //Of the stream being read, which decides whether blocks carry CRCs
+        u32 version{0};
+        vector<u8> pending;
+        //Bytes of `pending` already parsed, dropped at the end of each `update`
+        u64 position{0};
+        vector<Container::BlockInfo> blocks, index;
+        u64 offset{0};
+        u32 maxBlockSize{0};
+        u32 missingPresetId{0};
+    };
+
+    //Compresses `inputFile` to `outputFile`, or to `inputFile` plus ".lzip" when it's empty; "-" is stdin or stdout
+    [[nodiscard]] bool compressFile(const string& inputFile, const string& outputFile, const CompressOptions& options) noexcept;
+    //Compresses every file in `inputs`, and with `recursive` everything under the directories among them, each to its path plus ".lzip"
+    //Files share one pool: large ones are split into blocks, small ones are compressed whole a pack at a time; false if any file failed, `lastError` lists them
+    [[nodiscard]] bool compressFiles(const vector<string>& inputs, const CompressOptions& options) noexcept;
+    //Decompresses to `outputFile`, or to `inputFile` without ".lzip" when it's empty; reads both versions
+    [[nodiscard]] bool decompressFile(const string& inputFile, const string& outputFile, const DecompressOptions& options) noexcept;
+    //Decodes every block on the pool without writing anything, checking the CRCs of version 3 files, and reports the throughput
+    [[nodiscard]] bool testFile(const string& inputFile, const DecompressOptions& options) noexcept;
+    //Writes `length` original bytes from `offset` to `outputFile`, or to stdout when it's empty
+    [[nodiscard]] bool extractFile(const string& inputFile, const string& outputFile, u64 offset, u64 length, const DecompressOptions& options) noexcept;
+
+    //Code-length tables that blocks of up to 4 KiB can name by ID instead of carrying their own, see `CompressOptions::preset`
+    //ID of the built-in table `name`, "text" or "json"; 0 when there's no such table
+    [[nodiscard]] u32 builtinPreset(const string& name) noexcept;
+    //Counts the bytes of `sampleFiles`, and of every file under the directories among them, into a table written to `outputFile`; `id` is what blocks coded with it will name
+    [[nodiscard]] bool trainPreset(const vector<string>& sampleFiles, const string& outputFile, const OverwritePrompt& confirmOverwrite, u32& id) noexcept;
+    //Adds a table `trainPreset` wrote to this process, which the writer and every reader of blocks coded with it have to do first
+    [[nodiscard]] bool loadPreset(const string& file, u32& id) noexcept;
+
+    //Why the last file operation on this thread failed
+    [[nodiscard]] string lastError() noexcept;
+    //Whether file operations print summaries such as timings and the compression ratio
+    void setVerbose(bool verbose) noexcept;
+}
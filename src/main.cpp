@@ -1,20 +1,50 @@
-﻿#include <string>
+﻿#include <filesystem>
+#include <iomanip>
+#include <string>
 #include <iostream>
+#include <vector>
 #include <CLI/cli.hpp>
 #include <CLI/App.hpp>
 
-#include "compress.hpp"
-#include "decompress.hpp"
+#include "lzip.hpp"
 #include "meta.hpp"
-#include "utils.hpp"
 
 int main(int argc, char** argv) {
-    using std::string, std::cout, std::cerr, std::endl, CLI::App, CLI::CallForAllHelp, CLI::CallForHelp, CLI::CallForVersion, CLI::ParseError;
+    using std::string, std::cout, std::cin, std::cerr, std::endl, std::filesystem::path, CLI::App, CLI::CallForAllHelp, CLI::CallForHelp, CLI::CallForVersion, CLI::ParseError;
 
     #if _LZIP_WINDOWS
         SetConsoleCP(CP_UTF8);
         SetConsoleOutputCP(CP_UTF8);
     #endif
+    std::ios::sync_with_stdio(false);
+    const auto parseStatsFormat = [](const string& name) {
+        if (name.empty()) return Lzip::Util::StatsFormat::None;
+        return name == "json" ? Lzip::Util::StatsFormat::Json : Lzip::Util::StatsFormat::Text;
+    };
+    const Lzip::OverwritePrompt confirmOverwrite = [](const path& outputPath) {
+        cout << "输出文件 \"" << reinterpret_cast<const char*>(outputPath.u8string().c_str()) << "\" 已存在，是否覆盖？(y/n)：";
+        string input;
+        cin >> input;
+        if (input == "y" || input == "Y") return true;
+        cout << "操作已取消。\n";
+        return false;
+    };
+    //`--force` and `--keep` answer for every file; otherwise a single file asks, while a batch treats an existing output as an error for that file
+    const auto overwritePolicy = [&confirmOverwrite](bool force, bool keep, bool interactive) -> Lzip::OverwritePrompt {
+        if (force) return [](const path&) { return true; };
+        if (keep) return [](const path&) { return false; };
+        return interactive ? confirmOverwrite : nullptr;
+    };
+    //Built-in tables by name, anything else is a file `train` wrote
+    const auto usePreset = [](const string& preset) {
+        uint32_t id = Lzip::builtinPreset(preset);
+        if (id == 0 && !Lzip::loadPreset(preset, id)) {
+            cerr << Lzip::lastError() << endl;
+            exit(1);
+        }
+        return id;
+    };
+    bool verbose = false;
     App app;
     app.name(Lzip::LZIP_APP_NAME);
     app.allow_windows_style_options(false);
@@ -25,27 +55,169 @@ int main(int argc, char** argv) {
     app.set_config("");
     app.footer(Lzip::LZIP_COPYRIGHT_NOTICE);
     {
-        string inputFile, outputFile;
+        std::vector<string> inputFiles;
+        string outputFile;
+        uint64_t blockSize = Lzip::Container::DEFAULT_BLOCK_SIZE >> 20, memoryLimit = 0;
+        string stats, preset;
+        bool force = false, keep = false;
+        Lzip::CompressOptions options;
         auto* add = app.add_subcommand("c", "压缩文件操作");
-        add->add_option("input", inputFile, "需要被压缩的文件")->required();
-        add->add_option("output", outputFile, "输出文件（可选）");
-        add->callback([&inputFile, &outputFile]() {
-            if (!Lzip::compressFile(inputFile, outputFile)) {
-                cerr << Lzip::Util::getLastError() << endl;
+        add->add_option("input", inputFiles, "需要被压缩的文件或目录，- 表示标准输入；恰好两个参数且没有 -r 时第二个是输出文件，同 d 子命令；多个输入时各自输出到原路径加 .lzip")->required();
+        add->add_option("-o,--output", outputFile, "输出文件（只压缩一个文件时可用，- 表示标准输出）");
+        add->add_flag("-r,--recursive", options.recursive, "压缩目录下的所有文件（跳过 .lzip 文件），也用于批量压缩恰好两个文件");
+        auto* forceFlag = add->add_flag("-f,--force", force, "直接覆盖已存在的输出文件");
+        add->add_flag("-k,--keep", keep, "保留已存在的输出文件并跳过对应输入")->excludes(forceFlag);
+        add->add_option("-b,--block-size", blockSize, "区块大小（MiB），每个区块使用独立的霍夫曼表")->check(CLI::Range(Lzip::Container::MIN_BLOCK_SIZE >> 20, Lzip::Container::MAX_BLOCK_SIZE >> 20));
+        add->add_option("-l,--level", options.level, "压缩级别，0 只做霍夫曼编码，越高 LZ77 匹配搜索越深、越慢")->check(CLI::Range(0u, Lzip::Lz77::MAX_LEVEL));
+        add->add_option("-w,--window", options.windowLog, "LZ77 窗口大小（2 的幂次），不超过区块大小")->check(CLI::Range(Lzip::Lz77::MIN_WINDOW_LOG, Lzip::Lz77::MAX_WINDOW_LOG));
+        add->add_flag("--sampled", options.sampledHistogram, "只抽样统计字节频率来建立霍夫曼表，更快但压缩率略低");
+        add->add_flag("--interleave", options.interleaved, "把霍夫曼区块拆成 4 路交错子流，单核解压更快，每个区块多占 12 字节");
+        add->add_flag("--context", options.contextModel, "按前一个字节从至多 8 张霍夫曼表中选表编码，适合 CSV、定长记录等结构化数据，压缩稍慢");
+        add->add_option("--preset", preset, "不超过 4 KiB 的区块直接用预设霍夫曼表编码，省去统计频率和码表，适合小文件和 --flush：text、json 为内置表，其他值视为 train 生成的表文件，解压时也要用 --preset 提供");
+        add->add_option("-T,--threads", options.threads, "工作线程数，0 表示使用全部核心");
+        add->add_option("--in-flight", options.maxInFlight, "流水线深度，即同时驻留内存的区块数上限，0 表示线程数的两倍");
+        add->add_option("--memory-limit", memoryLimit, "缓冲与线程工作区的内存上限（MiB），超出时减少驻留区块数，再减少线程数，0 表示不限制");
+        add->add_flag("--stats{text}", stats, "输出各阶段耗时、数据量与区块类型统计，--stats=json 输出一行 JSON")->check(CLI::IsMember({"text", "json"}));
+        add->add_flag("--progress", options.progress, "在一行内持续显示已处理的数据量");
+        add->add_option("--flush", options.flushInterval, "流式压缩（毫秒）：边读边压，未满一个区块的数据最多等待这么久或输入暂停这么久就作为短区块立即输出，适合经管道实时传输日志")->check(CLI::Range(1u, 3600000u));
+        add->add_flag("-V,--verbose", verbose, "输出耗时、压缩比等摘要信息");
+        add->callback([&]() {
+            options.blockSize = blockSize << 20;
+            options.memoryLimit = memoryLimit << 20;
+            options.stats = parseStatsFormat(stats);
+            if (!preset.empty()) options.preset = usePreset(preset);
+            Lzip::setVerbose(verbose);
+            std::error_code ec;
+            //`c input output` keeps its old meaning, so only `-r` or a third argument makes a batch of two
+            if (inputFiles.size() == 2 && !options.recursive) {
+                if (!outputFile.empty()) {
+                    cerr << "输出文件已由第二个参数指定，不能再用 -o。" << endl;
+                    exit(1);
+                }
+                outputFile = inputFiles.back();
+                inputFiles.pop_back();
+            }
+            //In a batch every argument is an input, so a missing last one most likely meant `-o`
+            if (inputFiles.size() > 1 && inputFiles.back() != "-" && !std::filesystem::exists(path(inputFiles.back()), ec)) {
+                cerr << "输入文件不存在：" << inputFiles.back() << "，指定输出文件请使用 -o。" << endl;
+                exit(1);
+            }
+            const bool single = inputFiles.size() == 1 && !options.recursive && !std::filesystem::is_directory(path(inputFiles[0]), ec);
+            if (!single && !outputFile.empty()) {
+                cerr << "压缩多个文件时不能指定输出文件。" << endl;
+                exit(1);
+            }
+            if (!single && options.flushInterval > 0) {
+                cerr << "流式压缩只能用于单个输入。" << endl;
+                exit(1);
+            }
+            options.confirmOverwrite = overwritePolicy(force, keep, single);
+            if (!(single ? Lzip::compressFile(inputFiles[0], outputFile, options) : Lzip::compressFiles(inputFiles, options))) {
+                cerr << Lzip::lastError() << endl;
                 exit(1);
             }
         });
     }
     {
-        string inputFile, outputFile;
+        string inputFile, outputFile, outputOption, stats;
+        std::vector<string> presets;
+        uint64_t memoryLimit = 0;
+        bool force = false, keep = false;
+        Lzip::DecompressOptions options;
         auto* add = app.add_subcommand("d", "解压文件操作");
-        add->add_option("input", inputFile, "需要被解压的文件")->required();
-        add->add_option("output", outputFile, "输出文件（可选）");
-        add->callback([&inputFile, &outputFile]() {
-            if (!Lzip::decompressFile(inputFile, outputFile)) {
-                cerr << Lzip::Util::getLastError() << endl;
+        add->add_option("input", inputFile, "需要被解压的文件，- 表示标准输入")->required();
+        auto* outputArgument = add->add_option("output", outputFile, "输出文件（可选，缺省时去掉输入文件名的 .lzip 后缀，- 表示标准输出）");
+        add->add_option("-o,--output", outputOption, "输出文件，同 output，与 c 子命令一致")->excludes(outputArgument);
+        add->add_option("-T,--threads", options.threads, "工作线程数，0 表示使用全部核心");
+        add->add_option("--in-flight", options.maxInFlight, "流水线深度，即同时驻留内存的区块数上限，0 表示线程数的两倍");
+        add->add_option("--memory-limit", memoryLimit, "缓冲与线程工作区的内存上限（MiB），超出时减少驻留区块数，再减少线程数，0 表示不限制");
+        add->add_flag("--stats{text}", stats, "输出各阶段耗时、数据量与区块类型统计，--stats=json 输出一行 JSON")->check(CLI::IsMember({"text", "json"}));
+        add->add_flag("--progress", options.progress, "在一行内持续显示已写出的数据量");
+        add->add_option("--preset", presets, "压缩时用到的 train 生成的预设表文件，内置表不必提供");
+        auto* forceFlag = add->add_flag("-f,--force", force, "直接覆盖已存在的输出文件");
+        add->add_flag("-k,--keep", keep, "保留已存在的输出文件，不解压")->excludes(forceFlag);
+        add->add_flag("-V,--verbose", verbose, "输出耗时等摘要信息");
+        add->callback([&]() {
+            options.stats = parseStatsFormat(stats);
+            options.memoryLimit = memoryLimit << 20;
+            options.confirmOverwrite = overwritePolicy(force, keep, true);
+            if (!outputOption.empty()) outputFile = outputOption;
+            for (const string& preset : presets) static_cast<void>(usePreset(preset));
+            Lzip::setVerbose(verbose);
+            if (!Lzip::decompressFile(inputFile, outputFile, options)) {
+                cerr << Lzip::lastError() << endl;
+                exit(1);
+            }
+        });
+    }
+    {
+        std::vector<string> inputFiles, presets;
+        string stats;
+        uint64_t memoryLimit = 0;
+        Lzip::DecompressOptions options;
+        auto* add = app.add_subcommand("t", "测试文件完整性：并行解码并核对校验和，不写出任何数据");
+        add->add_option("input", inputFiles, "需要被测试的 Lzip 文件，- 表示标准输入")->required();
+        add->add_option("-T,--threads", options.threads, "工作线程数，0 表示使用全部核心");
+        add->add_option("--in-flight", options.maxInFlight, "流水线深度，即同时驻留内存的区块数上限，0 表示线程数的两倍");
+        add->add_option("--memory-limit", memoryLimit, "缓冲与线程工作区的内存上限（MiB），超出时减少驻留区块数，再减少线程数，0 表示不限制");
+        add->add_flag("--stats{text}", stats, "输出各阶段耗时、数据量与区块类型统计，--stats=json 输出一行 JSON")->check(CLI::IsMember({"text", "json"}));
+        add->add_option("--preset", presets, "压缩时用到的 train 生成的预设表文件，内置表不必提供");
+        add->callback([&]() {
+            options.stats = parseStatsFormat(stats);
+            options.memoryLimit = memoryLimit << 20;
+            for (const string& preset : presets) static_cast<void>(usePreset(preset));
+            bool passed = true;
+            for (const string& inputFile : inputFiles) if (!Lzip::testFile(inputFile, options)) {
+                cerr << inputFile << "：" << Lzip::lastError() << endl;
+                passed = false;
+            }
+            if (!passed) exit(1);
+        });
+    }
+    {
+        string inputFile, outputFile, outputOption;
+        std::vector<string> presets;
+        uint64_t offset = 0, length = 0;
+        bool force = false, keep = false;
+        auto* add = app.add_subcommand("x", "提取原始数据中的指定范围，只解压涉及的区块");
+        add->add_option("input", inputFile, "需要被提取的 Lzip 文件")->required();
+        auto* outputArgument = add->add_option("output", outputFile, "输出文件（可选，缺省时写到标准输出）");
+        add->add_option("-o,--output", outputOption, "输出文件，同 output，与 c 子命令一致")->excludes(outputArgument);
+        add->add_option("--offset", offset, "起始位置（字节）")->required();
+        add->add_option("--length", length, "长度（字节）")->required();
+        add->add_option("--preset", presets, "压缩时用到的 train 生成的预设表文件，内置表不必提供");
+        auto* forceFlag = add->add_flag("-f,--force", force, "直接覆盖已存在的输出文件");
+        add->add_flag("-k,--keep", keep, "保留已存在的输出文件，不提取")->excludes(forceFlag);
+        add->add_flag("-V,--verbose", verbose, "输出耗时等摘要信息");
+        add->callback([&]() {
+            if (!outputOption.empty()) outputFile = outputOption;
+            for (const string& preset : presets) static_cast<void>(usePreset(preset));
+            Lzip::setVerbose(verbose);
+            if (!Lzip::extractFile(inputFile, outputFile, offset, length, {.confirmOverwrite = overwritePolicy(force, keep, true)})) {
+                cerr << Lzip::lastError() << endl;
+                exit(1);
+            }
+        });
+    }
+    {
+        std::vector<string> sampleFiles;
+        string outputFile;
+        bool force = false, keep = false;
+        auto* add = app.add_subcommand("train", "从样本文件训练预设霍夫曼表，供压缩时用 --preset 引用");
+        add->add_option("input", sampleFiles, "样本文件或目录（包括其下所有文件），- 表示标准输入")->required();
+        add->add_option("-o,--output", outputFile, "输出的预设表文件")->required();
+        auto* forceFlag = add->add_flag("-f,--force", force, "直接覆盖已存在的输出文件");
+        add->add_flag("-k,--keep", keep, "保留已存在的输出文件，不训练")->excludes(forceFlag);
+        add->add_flag("-V,--verbose", verbose, "输出耗时与样本量");
+        add->callback([&]() {
+            Lzip::setVerbose(verbose);
+            uint32_t id;
+            if (!Lzip::trainPreset(sampleFiles, outputFile, overwritePolicy(force, keep, true), id)) {
+                cerr << Lzip::lastError() << endl;
                 exit(1);
             }
+            //Always shown, since it is what a missing table is reported by when decompressing
+            cout << "预设表 ID：" << std::hex << std::uppercase << std::setw(8) << std::setfill('0') << id << std::dec << endl;
         });
     }
     try { app.parse(argc, argv); }
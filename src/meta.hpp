@@ -14,5 +14,11 @@ namespace Lzip {
         * LZIP_SEMATIC_VERSION = "1.0.0";
 
     inline constexpr array<u8, 4> LZIP_MAGIC = { 'L', 'z', 'i', 'p' };
-    inline constexpr u32 LZIP_VERSION = 1u;
+    inline constexpr u32 LZIP_VERSION = 3u;
+    //Version 3 that may also hold `BlockType::HuffmanPreset` blocks, written only when a preset is selected so every other file stays readable by version 3 readers
+    inline constexpr u32 LZIP_PRESET_VERSION = 4u;
+    //Blocks like version 3 but no checksums, still readable
+    inline constexpr u32 LZIP_UNCHECKED_VERSION = 2u;
+    //Single global table and one continuous bitstream, still readable
+    inline constexpr u32 LZIP_LEGACY_VERSION = 1u;
 }
\ No newline at end of file
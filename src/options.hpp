@@ -0,0 +1,62 @@
+﻿#pragma once
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+
+#include "container.hpp"
+#include "lz77.hpp"
+#include "stats.hpp"
+
+namespace Lzip {
+    typedef uint32_t u32;
+    typedef uint64_t u64;
+
+    //Asked before an existing output file is replaced, false leaves it alone; without one an existing output is an error
+    typedef std::function<bool(const std::filesystem::path&)> OverwritePrompt;
+
+    struct CompressOptions {
+        u64 blockSize{Container::DEFAULT_BLOCK_SIZE};
+        //0 codes bytes directly, higher levels search harder for LZ77 matches
+        u32 level{Lz77::DEFAULT_LEVEL};
+        //Matches reach back at most `1 << windowLog` bytes, never past the start of their block
+        u32 windowLog{Lz77::MAX_WINDOW_LOG};
+        //0 means one per hardware core
+        u32 threads{0};
+        //Pipeline depth: blocks read but not yet written, bounds memory to about twice this many blocks; 0 means twice the thread count
+        u32 maxInFlight{0};
+        //Bytes the file functions may allocate for block buffers and per-thread scratch, met by holding fewer blocks in flight and then running fewer threads; mapped files don't count, 0 means no limit
+        u64 memoryLimit{0};
+        //Builds Huffman tables from a sample of each block instead of counting every byte
+        bool sampledHistogram{false};
+        //Splits Huffman blocks into 4 sub-streams that one core can decode side by side
+        bool interleaved{false};
+        //Also tries coding each byte with a table picked by the byte before it, which suits records and tables but costs a pass over pair counts per block
+        bool contextModel{false};
+        //ID of a preset table (see `Preset`) that codes blocks of up to `Preset::MAX_BLOCK_SIZE` bytes without counting them or storing a table, for small files and frequent flushes; 0 gives every block its own
+        u32 preset{0};
+        //Prints how long each stage worked and stalled, and what came out, as text or a JSON line
+        Util::StatsFormat stats{Util::StatsFormat::None};
+        //Keeps a line updated with how much has been read
+        bool progress{false};
+        //`compressFiles` also takes everything under directories, skipping files that already end in ".lzip"
+        bool recursive{false};
+        //`compressFile` codes on the calling thread as input arrives and sends what waits for a full block as a short block once the oldest of it is this many milliseconds old, or the input pauses that long
+        //Meant for live streams such as logs on a pipe; threads, pipeline depth and stats don't apply, 0 turns it off
+        u32 flushInterval{0};
+        OverwritePrompt confirmOverwrite;
+    };
+
+    struct DecompressOptions {
+        //0 means one per hardware core
+        u32 threads{0};
+        //Pipeline depth: blocks read but not yet written, bounds memory to about twice this many blocks; 0 means twice the thread count
+        u32 maxInFlight{0};
+        //Bytes the file functions may allocate for block buffers and per-thread scratch, met by holding fewer blocks in flight and then running fewer threads; mapped files don't count, 0 means no limit
+        u64 memoryLimit{0};
+        //Prints how long each stage worked and stalled, and what came out, as text or a JSON line
+        Util::StatsFormat stats{Util::StatsFormat::None};
+        //Keeps a line updated with how much has been written
+        bool progress{false};
+        OverwritePrompt confirmOverwrite;
+    };
+}
@@ -0,0 +1,140 @@
+﻿#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+#include "threadpool.hpp"
+#include "utils.hpp"
+
+namespace Lzip::Util {
+    typedef uint8_t u8;
+    typedef uint32_t u32;
+    typedef uint64_t u64;
+    using std::atomic, std::thread, std::vector, std::chrono::steady_clock, std::chrono::duration_cast, std::chrono::nanoseconds;
+
+    //Nanoseconds each stage spent working and waiting on its neighbours
+    struct PipelineStats {
+        u64 blocks{0};
+        //Reader: inside `read`, and waiting for a slot the writer hasn't released yet
+        u64 readTime{0}, readStall{0};
+        //Workers: inside `process`, summed over all threads
+        u64 processTime{0};
+        //Writer: inside `write`, and waiting for the next block in order to be processed
+        u64 writeTime{0}, writeStall{0};
+        u64 wallTime{0};
+        u32 threads{0};
+    };
+
+    enum class ReadStatus : u8 {
+        Filled,
+        End,
+        Failed,
+    };
+
+    //Where a slot is in the ring; `Filled` slots belong to the pool, `Done`, `End` and `Failed` ones to the writer
+    enum class SlotStage : u32 {
+        Free,
+        Filled,
+        Done,
+        End,
+        Failed,
+    };
+
+    //Shrinks the ring, then the pool along with it, until `slots` slots of `slotBytes` and `threads` workers of `workerBytes` fit in `limit`
+    //A ring shorter than the pool leaves workers idle, so the pool never outgrows it; 0 means no limit, false if one slot and one worker don't fit
+    [[nodiscard]] inline bool fitMemory(u64 limit, u64 slotBytes, u64 workerBytes, u32& threads, u64& slots) noexcept {
+        if (limit == 0) return true;
+        if (slotBytes + workerBytes > limit) return false;
+        while (slots * slotBytes + threads * workerBytes > limit) {
+            if (threads > 1 && threads >= slots) threads--;
+            else slots--;
+        }
+        return true;
+    }
+
+    template <typename Slot> [[nodiscard]] inline Slot& slotAt(vector<Slot>& slots, u64 index) noexcept { return slots[index % slots.size()]; }
+
+    [[nodiscard]] inline u64 elapsedNanos(steady_clock::time_point since) noexcept {
+        return static_cast<u64>(duration_cast<nanoseconds>(steady_clock::now() - since).count());
+    }
+
+    //A reader thread fills the ring of `slots` in order while the writer drains it in the same order on the calling thread, `process` runs on `pool` in between
+    //`Slot` needs `atomic<SlotStage> stage` and `bool succeeded`; `read(slot)` returns a `ReadStatus`, `process(slot)` and `write(slot)` return false to stop the pipeline
+    //Returns false if any stage failed, the callbacks leave the reason
+    template <typename Slot, typename Read, typename Process, typename Write>
+    [[nodiscard]] inline bool runPipeline(vector<Slot>& slots, ThreadPool& pool, Read&& read, Process&& process, Write&& write, PipelineStats& stats) noexcept {
+        const steady_clock::time_point startTime = steady_clock::now();
+        for (Slot& slot : slots) slot.stage.store(SlotStage::Free, std::memory_order_relaxed);
+        atomic<bool> cancelled{false};
+        atomic<u64> processTime{0};
+        u64 readTime = 0, readStall = 0;
+        thread reader([&]() {
+            for (u64 i = 0;; i++) {
+                Slot& slot = slotAt(slots, i);
+                steady_clock::time_point waitStart = steady_clock::now();
+                for (SlotStage stage = slot.stage.load(std::memory_order_acquire); stage != SlotStage::Free; stage = slot.stage.load(std::memory_order_acquire)) {
+                    if (cancelled.load(std::memory_order_relaxed)) return;
+                    slot.stage.wait(stage, std::memory_order_acquire);
+                }
+                readStall += elapsedNanos(waitStart);
+                if (cancelled.load(std::memory_order_relaxed)) return;
+                waitStart = steady_clock::now();
+                const ReadStatus status = read(slot);
+                readTime += elapsedNanos(waitStart);
+                if (status != ReadStatus::Filled) {
+                    slot.stage.store(status == ReadStatus::End ? SlotStage::End : SlotStage::Failed, std::memory_order_release);
+                    slot.stage.notify_all();
+                    return;
+                }
+                slot.stage.store(SlotStage::Filled, std::memory_order_relaxed);
+                pool.submit([&slot, &process, &processTime]() {
+                    const steady_clock::time_point taskStart = steady_clock::now();
+                    slot.succeeded = process(slot);
+                    processTime.fetch_add(elapsedNanos(taskStart), std::memory_order_relaxed);
+                    slot.stage.store(SlotStage::Done, std::memory_order_release);
+                    slot.stage.notify_all();
+                });
+            }
+        });
+        bool succeeded = true;
+        u64 blocks = 0;
+        for (;; blocks++) {
+            Slot& slot = slotAt(slots, blocks);
+            const steady_clock::time_point waitStart = steady_clock::now();
+            SlotStage stage = slot.stage.load(std::memory_order_acquire);
+            for (; stage == SlotStage::Free || stage == SlotStage::Filled; stage = slot.stage.load(std::memory_order_acquire)) slot.stage.wait(stage, std::memory_order_acquire);
+            stats.writeStall += elapsedNanos(waitStart);
+            if (stage != SlotStage::Done) {
+                succeeded = stage == SlotStage::End;
+                break;
+            }
+            const steady_clock::time_point writeStart = steady_clock::now();
+            const bool written = slot.succeeded && write(slot);
+            stats.writeTime += elapsedNanos(writeStart);
+            if (!written) {
+                succeeded = false;
+                break;
+            }
+            slot.stage.store(SlotStage::Free, std::memory_order_release);
+            slot.stage.notify_all();
+        }
+        //On failure the reader may still be waiting for a slot: release every slot the pool doesn't hold so it wakes up and sees the cancellation
+        cancelled.store(true, std::memory_order_relaxed);
+        for (Slot& slot : slots) {
+            SlotStage stage = slot.stage.load(std::memory_order_acquire);
+            if (stage != SlotStage::Filled && slot.stage.compare_exchange_strong(stage, SlotStage::Free, std::memory_order_acq_rel)) slot.stage.notify_all();
+        }
+        reader.join();
+        //Blocks already on the pool must finish before their slots go away
+        for (Slot& slot : slots) for (SlotStage stage = slot.stage.load(std::memory_order_acquire); stage == SlotStage::Filled; stage = slot.stage.load(std::memory_order_acquire)) slot.stage.wait(stage, std::memory_order_acquire);
+        stats.blocks += blocks;
+        stats.readTime += readTime;
+        stats.readStall += readStall;
+        stats.processTime += processTime.load(std::memory_order_relaxed);
+        stats.wallTime += elapsedNanos(startTime);
+        stats.threads = pool.threadCount;
+        return succeeded;
+    }
+}
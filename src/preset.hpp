@@ -0,0 +1,180 @@
+﻿#pragma once
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <string>
+#include <string_view>
+
+#include "checksum.hpp"
+#include "huffman.hpp"
+
+//Code-length tables a block can name by ID instead of carrying 256 lengths of its own, for blocks too small to pay for a table and a pass counting their bytes
+//Built-in tables have small IDs and are compiled in; trained ones are named by the CRC-32C of their lengths with `TRAINED_ID_BIT` set, and have to be added to every process that writes or reads blocks coded with them
+namespace Lzip::Preset {
+    typedef uint8_t u8;
+    typedef uint16_t u16;
+    typedef uint32_t u32;
+    typedef uint64_t u64;
+    using std::array, std::span, std::string_view, std::unique_ptr;
+
+    typedef array<u8, 256> CodeLengths;
+
+    //Every byte has a code, so a table fits any input; 12 bits keeps blocks on a fast decoding kernel
+    inline constexpr u16 MAX_CODE_LEN = 12;
+    inline constexpr u32 TRAINED_ID_BIT = 0x80000000u;
+    //Past a few KiB a block's own table pays for its 256 bytes and codes it better than a shared one
+    inline constexpr u64 MAX_BLOCK_SIZE = 4096;
+    //Files `train` writes: magic, then the 256 code lengths
+    inline constexpr array<u8, 4> FILE_MAGIC = {'L', 'z', 'p', 't'};
+    inline constexpr u64 FILE_SIZE = FILE_MAGIC.size() + 256;
+    //Built-in and trained tables one process can hold, far more than anyone loads
+    inline constexpr u32 MAX_TABLES = 256;
+
+    struct BuiltinTable {
+        u32 id{0};
+        const char* name{nullptr};
+        CodeLengths lengths{};
+    };
+
+    //Every byte has a code and no bit pattern is left without one
+    [[nodiscard]] constexpr bool isComplete(const CodeLengths& lengths) noexcept {
+        u64 kraftSum = 0;
+        for (const u8 length : lengths) {
+            if (length == 0 || length > MAX_CODE_LEN) return false;
+            kraftSum += u64(1) << (MAX_CODE_LEN - length);
+        }
+        return kraftSum == u64(1) << MAX_CODE_LEN;
+    }
+
+    //Trained the same way `train` does, on English prose and documentation, and on JSON documents of assorted schemas
+    inline constexpr array<BuiltinTable, 2> BUILTIN_TABLES{{
+        {1, "text", {
+            12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 6, 12, 12, 12, 12, 12,
+            12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12,
+            3, 12, 10, 7, 12, 12, 12, 9, 7, 7, 6, 12, 8, 7, 6, 5,
+            7, 7, 7, 7, 7, 8, 8, 8, 8, 8, 7, 11, 10, 9, 10, 12,
+            11, 9, 10, 9, 10, 9, 10, 10, 10, 9, 11, 11, 9, 9, 9, 9,
+            9, 12, 9, 8, 9, 10, 10, 11, 12, 11, 12, 7, 9, 7, 12, 8,
+            6, 5, 6, 5, 5, 4, 6, 6, 6, 5, 8, 8, 5, 6, 5, 4,
+            6, 11, 5, 5, 4, 6, 8, 8, 9, 7, 11, 11, 12, 11, 12, 12,
+            12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12,
+            12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12,
+            12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12,
+            12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12,
+            12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12,
+            12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12,
+            12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12,
+            12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12
+        }},
+        {2, "json", {
+            12, 12, 12, 12, 12, 12, 12, 12, 12, 11, 5, 12, 12, 7, 12, 12,
+            12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12,
+            2, 12, 4, 12, 12, 12, 12, 12, 12, 12, 12, 11, 6, 7, 5, 7,
+            6, 6, 7, 7, 7, 7, 7, 8, 8, 8, 6, 12, 11, 10, 11, 12,
+            12, 9, 9, 8, 10, 9, 10, 10, 10, 9, 11, 11, 10, 9, 9, 10,
+            9, 11, 9, 8, 9, 10, 10, 10, 11, 11, 11, 10, 12, 10, 11, 7,
+            12, 5, 7, 6, 6, 5, 7, 7, 6, 5, 9, 8, 6, 6, 5, 5,
+            6, 10, 6, 5, 5, 7, 8, 9, 8, 7, 9, 8, 10, 8, 12, 12,
+            12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12,
+            12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12,
+            12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12,
+            12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12,
+            12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12,
+            12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12,
+            12, 12, 12, 12, 12, 11, 11, 11, 11, 11, 12, 12, 12, 12, 12, 12,
+            12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12
+        }},
+    }};
+    static_assert(isComplete(BUILTIN_TABLES[0].lengths) && isComplete(BUILTIN_TABLES[1].lengths));
+
+    //A table ready for both directions, built once when it's added
+    struct Table {
+        u32 id{0};
+        CodeLengths lengths{};
+        array<Huffman::HuffmanCode, 256> codes;
+        Huffman::DecodeTable decodeTable;
+    };
+
+    [[nodiscard]] inline u32 trainedId(const CodeLengths& lengths) noexcept { return Checksum::crc32c(lengths) | TRAINED_ID_BIT; }
+
+    //Lengths for bytes counted over a sample; bytes the sample never shows still get a code, so the table fits any input
+    inline void train(const array<u64, 256>& frequencies, CodeLengths& lengths) noexcept {
+        array<u64, 256> weights;
+        for (u32 i = 0; i < 256; i++) weights[i] = frequencies[i] + 1;
+        array<Huffman::HuffmanCode, 256> codes;
+        u16 presentedByteCount;
+        Huffman::getHuffmanCode(weights, codes, presentedByteCount, MAX_CODE_LEN);
+        for (u32 i = 0; i < 256; i++) lengths[i] = static_cast<u8>(codes[i].codeLen);
+    }
+
+    //Null unless every byte has a code of at most `MAX_CODE_LEN` bits and the codes are prefix-free
+    [[nodiscard]] inline unique_ptr<Table> buildTable(u32 id, const CodeLengths& lengths) noexcept {
+        for (const u8 length : lengths) if (length == 0 || length > MAX_CODE_LEN) return nullptr;
+        auto table = std::make_unique<Table>();
+        table->id = id;
+        table->lengths = lengths;
+        if (!Huffman::getCanonicalCode(lengths, table->codes, MAX_CODE_LEN) || !Huffman::buildDecodeTable(table->codes, table->decodeTable)) return nullptr;
+        return table;
+    }
+
+    //Tables are never removed, so what `find` returns stays valid for the rest of the process
+    //Slots only fill up: one is set before `count` publishes it and never changes again, so `find` runs on every block without a lock and only `add` takes `mutex`
+    class Registry {
+    public:
+        Registry() noexcept {
+            u32 size = 0;
+            for (const BuiltinTable& builtin : BUILTIN_TABLES) tables[size++] = buildTable(builtin.id, builtin.lengths);
+            count.store(size, std::memory_order_release);
+        }
+
+        [[nodiscard]] const Table* find(u32 id) const noexcept {
+            const u32 size = count.load(std::memory_order_acquire);
+            for (u32 i = 0; i < size; i++) if (tables[i]->id == id) return tables[i].get();
+            return nullptr;
+        }
+
+        //Adding a table twice is harmless, `id` is the same both times; false for lengths that aren't a complete code, or once `MAX_TABLES` are held
+        [[nodiscard]] bool add(const CodeLengths& lengths, u32& id) noexcept {
+            id = trainedId(lengths);
+            if (find(id)) return true;
+            unique_ptr<Table> table = buildTable(id, lengths);
+            if (!table) return false;
+            std::lock_guard lock(mutex);
+            //Another thread may have added it since the lookup above
+            if (find(id)) return true;
+            const u32 size = count.load(std::memory_order_relaxed);
+            if (size == MAX_TABLES) return false;
+            tables[size] = std::move(table);
+            count.store(size + 1, std::memory_order_release);
+            return true;
+        }
+
+    private:
+        std::mutex mutex;
+        array<unique_ptr<Table>, MAX_TABLES> tables;
+        std::atomic<u32> count{0};
+    };
+
+    [[nodiscard]] inline Registry& registry() noexcept {
+        static Registry instance;
+        return instance;
+    }
+
+    [[nodiscard]] inline const Table* find(u32 id) noexcept { return registry().find(id); }
+
+    //8 hex digits, how IDs are shown to users
+    [[nodiscard]] inline std::string formatId(u32 id) noexcept {
+        constexpr const char* DIGITS = "0123456789ABCDEF";
+        std::string text(8, '0');
+        for (u32 i = 0; i < 8; i++) text[7 - i] = DIGITS[(id >> (4 * i)) & 15];
+        return text;
+    }
+
+    [[nodiscard]] inline u32 builtinId(string_view name) noexcept {
+        for (const BuiltinTable& builtin : BUILTIN_TABLES) if (name == builtin.name) return builtin.id;
+        return 0;
+    }
+}
@@ -0,0 +1,146 @@
+﻿#pragma once
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <iomanip>
+#include <ostream>
+
+#include "container.hpp"
+#include "pipeline.hpp"
+#include "utils.hpp"
+
+#if _LZIP_WINDOWS
+    #include <psapi.h> // IWYU pragma: keep
+#else
+    #include <sys/resource.h> // IWYU pragma: keep
+#endif
+
+namespace Lzip::Util {
+    typedef uint8_t u8;
+    typedef uint32_t u32;
+    typedef uint64_t u64;
+    using std::array, std::fixed, std::flush, std::setprecision, std::chrono::steady_clock, std::chrono::milliseconds;
+
+    enum class StatsFormat : u8 {
+        None,
+        Text,
+        Json,
+    };
+
+    //Splits a stretch of work into consecutive steps on a monotonic clock
+    struct StageClock {
+        steady_clock::time_point last{steady_clock::now()};
+
+        //Nanoseconds since the previous lap, or since the clock was made
+        [[nodiscard]] u64 lap() noexcept {
+            const steady_clock::time_point now = steady_clock::now();
+            const u64 nanos = static_cast<u64>(std::chrono::duration_cast<std::chrono::nanoseconds>(now - last).count());
+            last = now;
+            return nanos;
+        }
+    };
+
+    //Nanoseconds blocks spent in each coding step; every slot fills its own and the writer sums them, so workers never share a counter
+    struct CodingStats {
+        u64 histogramTime{0}, tableTime{0}, codingTime{0}, checksumTime{0};
+
+        void add(const CodingStats& other) noexcept {
+            histogramTime += other.histogramTime;
+            tableTime += other.tableTime;
+            codingTime += other.codingTime;
+            checksumTime += other.checksumTime;
+        }
+    };
+
+    struct RunStats {
+        PipelineStats pipeline;
+        CodingStats coding;
+        u64 inputBytes{0}, outputBytes{0};
+        //Slot buffers only grow, so their capacities at the end are the most the pipeline held at once
+        u64 peakBufferBytes{0};
+        //What the run was held to, 0 without a limit
+        u64 memoryLimit{0};
+        //Indexed by `Container::BlockType`
+        array<u64, 256> blockTypes{};
+    };
+
+    //Rewrites one status line at most every `INTERVAL`, however small the blocks or fast the run
+    struct Progress {
+        static constexpr milliseconds INTERVAL{250};
+        bool enabled{false};
+        //0 when the size isn't known up front, as with a pipe
+        u64 total{0};
+        steady_clock::time_point lastUpdate{steady_clock::now()};
+
+        void update(u64 done) noexcept {
+            if (!enabled) return;
+            const steady_clock::time_point now = steady_clock::now();
+            if (now - lastUpdate < INTERVAL) return;
+            lastUpdate = now;
+            print(done);
+        }
+
+        void finish(u64 done) noexcept {
+            if (!enabled) return;
+            print(done);
+            report() << '\n' << flush;
+        }
+
+        void print(u64 done) const noexcept {
+            constexpr double MIB = 1048576.0;
+            report() << fixed << setprecision(1) << "\r已处理 " << static_cast<double>(done) / MIB << " MiB";
+            if (total > 0) report() << " / " << static_cast<double>(total) / MIB << " MiB（" << static_cast<double>(done) * 100 / static_cast<double>(total) << "%）";
+            report() << flush;
+        }
+    };
+
+    //Most physical memory the process has held so far, 0 where the system can't tell
+    [[nodiscard]] inline u64 peakMemoryBytes() noexcept {
+        #if _LZIP_WINDOWS
+            PROCESS_MEMORY_COUNTERS counters{};
+            return GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)) ? counters.PeakWorkingSetSize : 0;
+        #else
+            rusage usage{};
+            if (getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+            //Bytes on macOS, kibibytes everywhere else
+            #if defined(__APPLE__)
+                return static_cast<u64>(usage.ru_maxrss);
+            #else
+                return static_cast<u64>(usage.ru_maxrss) * 1024;
+            #endif
+        #endif
+    }
+
+    //Worker times are summed over all threads, so they can exceed the wall time; a stage that stalls a lot is waiting on its neighbour
+    inline void printStats(const char* operation, const RunStats& stats, StatsFormat format) noexcept {
+        const PipelineStats& pipeline = stats.pipeline;
+        const auto ms = [](u64 nanos) { return static_cast<double>(nanos) / 1e6; };
+        if (format == StatsFormat::Json) {
+            report() << fixed << setprecision(3) << "{\"operation\":\"" << operation << "\",\"threads\":" << pipeline.threads << ",\"blocks\":" << pipeline.blocks
+                << ",\"bytesIn\":" << stats.inputBytes << ",\"bytesOut\":" << stats.outputBytes << ",\"peakBufferBytes\":" << stats.peakBufferBytes
+                << ",\"peakMemoryBytes\":" << peakMemoryBytes() << ",\"memoryLimit\":" << stats.memoryLimit
+                << ",\"wallMs\":" << ms(pipeline.wallTime) << ",\"readMs\":" << ms(pipeline.readTime) << ",\"readStallMs\":" << ms(pipeline.readStall)
+                << ",\"histogramMs\":" << ms(stats.coding.histogramTime) << ",\"tableMs\":" << ms(stats.coding.tableTime) << ",\"codingMs\":" << ms(stats.coding.codingTime) << ",\"checksumMs\":" << ms(stats.coding.checksumTime)
+                << ",\"writeMs\":" << ms(pipeline.writeTime) << ",\"writeStallMs\":" << ms(pipeline.writeStall) << ",\"blockTypes\":{";
+            bool first = true;
+            for (u32 type = 0; type < stats.blockTypes.size(); type++) if (stats.blockTypes[type] > 0) {
+                report() << (first ? "" : ",") << '"' << Container::blockTypeName(static_cast<Container::BlockType>(type)) << "\":" << stats.blockTypes[type];
+                first = false;
+            }
+            report() << "}}\n" << flush;
+            return;
+        }
+        const double utilization = pipeline.wallTime > 0 && pipeline.threads > 0 ? static_cast<double>(pipeline.processTime) / (static_cast<double>(pipeline.wallTime) * pipeline.threads) * 100 : 0;
+        report() << fixed << setprecision(1) << "流水线：" << pipeline.blocks << " 个区块，耗时 " << ms(pipeline.wallTime) << " 毫秒\n"
+            << "  读取：" << ms(pipeline.readTime) << " 毫秒，等待空闲缓冲 " << ms(pipeline.readStall) << " 毫秒\n"
+            << "  处理：" << ms(pipeline.processTime) << " 毫秒，" << pipeline.threads << " 个线程，利用率 " << utilization << "%\n"
+            << "    统计频率 " << ms(stats.coding.histogramTime) << " 毫秒，建表 " << ms(stats.coding.tableTime) << " 毫秒，编解码 " << ms(stats.coding.codingTime) << " 毫秒，校验 " << ms(stats.coding.checksumTime) << " 毫秒\n"
+            << "  写入：" << ms(pipeline.writeTime) << " 毫秒，等待区块 " << ms(pipeline.writeStall) << " 毫秒\n"
+            << "数据：读入 " << stats.inputBytes << " 字节，写出 " << stats.outputBytes << " 字节\n"
+            << "内存：缓冲峰值 " << stats.peakBufferBytes << " 字节，进程峰值 " << peakMemoryBytes() << " 字节";
+        if (stats.memoryLimit > 0) report() << "，上限 " << stats.memoryLimit << " 字节";
+        report() << "\n区块类型：";
+        for (u32 type = 0; type < stats.blockTypes.size(); type++) if (stats.blockTypes[type] > 0) report() << Container::blockTypeName(static_cast<Container::BlockType>(type)) << ' ' << stats.blockTypes[type] << ' ';
+        report() << '\n' << flush;
+    }
+}
@@ -0,0 +1,109 @@
+﻿#pragma once
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace Lzip::Util {
+    typedef uint32_t u32;
+    typedef uint64_t u64;
+    using std::atomic, std::condition_variable, std::deque, std::function, std::mutex, std::lock_guard, std::unique_lock, std::unique_ptr, std::thread, std::vector;
+
+    //0 means one thread per hardware core
+    [[nodiscard]] inline u32 resolveThreadCount(u32 requested) noexcept {
+        if (requested > 0) return requested;
+        return std::max(1u, thread::hardware_concurrency());
+    }
+
+    //Every worker owns a queue and takes from its front, idle workers steal from the back of the others
+    struct ThreadPool {
+        struct WorkerQueue {
+            mutex lock;
+            deque<function<void()>> tasks;
+        };
+
+        u32 threadCount;
+        unique_ptr<WorkerQueue[]> queues;
+        vector<thread> workers;
+        mutex sleepLock;
+        condition_variable wakeUp;
+        atomic<u64> queuedCount{0};
+        atomic<u32> nextQueue{0};
+        bool stopping{false};
+
+        [[nodiscard]] explicit ThreadPool(u32 threads) noexcept : threadCount(resolveThreadCount(threads)), queues(new WorkerQueue[threadCount]) {
+            workers.reserve(threadCount);
+            for (u32 i = 0; i < threadCount; i++) workers.emplace_back([this, i]() { workerLoop(i); });
+        }
+
+        ThreadPool(const ThreadPool&) = delete;
+        ThreadPool& operator=(const ThreadPool&) = delete;
+
+        //Runs whatever is still queued, then joins
+        ~ThreadPool() noexcept {
+            {
+                lock_guard<mutex> guard(sleepLock);
+                stopping = true;
+            }
+            wakeUp.notify_all();
+            for (thread& worker : workers) worker.join();
+        }
+
+        void submit(function<void()> task) noexcept {
+            {
+                //Counted under the sleep lock so a worker can't miss the wake-up between its check and its wait, and before the push so a quick pop can't underflow it
+                lock_guard<mutex> guard(sleepLock);
+                queuedCount.fetch_add(1, std::memory_order_relaxed);
+            }
+            WorkerQueue& queue = queues[nextQueue.fetch_add(1, std::memory_order_relaxed) % threadCount];
+            {
+                lock_guard<mutex> guard(queue.lock);
+                queue.tasks.push_back(std::move(task));
+            }
+            wakeUp.notify_one();
+        }
+
+        [[nodiscard]] bool tryPop(u32 index, function<void()>& task) noexcept {
+            {
+                WorkerQueue& own = queues[index];
+                lock_guard<mutex> guard(own.lock);
+                if (!own.tasks.empty()) {
+                    task = std::move(own.tasks.front());
+                    own.tasks.pop_front();
+                    return true;
+                }
+            }
+            for (u32 i = 1; i < threadCount; i++) {
+                WorkerQueue& victim = queues[(index + i) % threadCount];
+                lock_guard<mutex> guard(victim.lock);
+                if (!victim.tasks.empty()) {
+                    task = std::move(victim.tasks.back());
+                    victim.tasks.pop_back();
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        void workerLoop(u32 index) noexcept {
+            function<void()> task;
+            while (true) {
+                if (tryPop(index, task)) {
+                    queuedCount.fetch_sub(1, std::memory_order_relaxed);
+                    task();
+                    task = nullptr;
+                    continue;
+                }
+                unique_lock<mutex> lock(sleepLock);
+                wakeUp.wait(lock, [this]() { return stopping || queuedCount.load(std::memory_order_relaxed) > 0; });
+                if (stopping && queuedCount.load(std::memory_order_relaxed) == 0) return;
+            }
+        }
+    };
+}
\ No newline at end of file
@@ -2,6 +2,8 @@
 #include <array>
 #include <bit>
 #include <bitset>
+#include <cerrno>
+#include <cstring>
 #include <filesystem>
 #include <fstream>
 #include <iostream>
@@ -15,84 +17,433 @@
 #if defined(_WIN32) || defined(_WIN64) || defined(__WIN32__) || defined(__NT__)
     #define _LZIP_WINDOWS 1
     #include <windows.h> // IWYU pragma: keep
+    #include <fcntl.h> // IWYU pragma: keep
+    #include <io.h> // IWYU pragma: keep
 #else
     #define _LZIP_UNIX 1
+    #include <fcntl.h> // IWYU pragma: keep
+    #include <poll.h> // IWYU pragma: keep
+    #include <sys/mman.h> // IWYU pragma: keep
+    #include <sys/stat.h> // IWYU pragma: keep
     #include <unistd.h> // IWYU pragma: keep
 #endif
 
+//For hot lambdas that compilers would otherwise call out of line, keeping their state in memory
+#if defined(__GNUC__) || defined(__clang__)
+    #define _LZIP_FORCE_INLINE __attribute__((always_inline))
+#else
+    #define _LZIP_FORCE_INLINE
+#endif
+
 namespace Lzip::Util {
     typedef uint8_t u8;
+    typedef uint32_t u32;
     typedef uint64_t u64;
-    using std::array, std::endian, std::bit_cast, std::cout, std::flush, std::bitset, std::to_string, std::string, std::filesystem::path, std::span, std::min, std::ofstream, std::ifstream, std::vector, std::error_code, std::is_integral_v, Huffman::HuffmanCode;
+    using std::array, std::endian, std::bit_cast, std::cout, std::cin, std::flush, std::bitset, std::to_string, std::string, std::filesystem::path, std::span, std::min, std::ofstream, std::ifstream, std::vector, std::error_code, std::is_integral_v, Huffman::HuffmanCode;
 
     #define STR(p) reinterpret_cast<const char*>(p.u8string().c_str())
 
+    //Progress, statistics and summaries, moved to stderr once stdout carries data
+    inline std::ostream* statusStream = &cout;
+    //Summaries are only printed with `verbose`, a run is otherwise silent unless it fails or was asked for progress or statistics
+    inline bool verbose = false;
+    //No buffer, so everything written to it is dropped
+    inline std::ostream discardStream(nullptr);
+    [[nodiscard]] inline std::ostream& status() noexcept { return verbose ? *statusStream : discardStream; }
+    //For output the user asked for explicitly, printed whether `verbose` or not
+    [[nodiscard]] inline std::ostream& report() noexcept { return *statusStream; }
+
     inline void printCodes(const array<HuffmanCode, 256>& codes) noexcept {
-        for (u64 i = 0; i < 256; i++) if (codes[i].codeLen > 0) {
-            cout << "字节 " << to_string(i) << "：" << bitset<64>(codes[i].code).to_string().substr(64 - codes[i].codeLen) << "\n";
-            cout << flush;
-        }
+        if (!verbose) return;
+        for (u64 i = 0; i < 256; i++) if (codes[i].codeLen > 0) status() << "字节 " << to_string(i) << "：" << bitset<64>(codes[i].code).to_string().substr(64 - codes[i].codeLen) << "\n";
+        status() << flush;
     }
 
-    inline string errorMessage;
+    //Per thread, so callers compressing on several threads each see their own
+    inline thread_local string errorMessage;
 
     [[nodiscard]] inline string getLastError() noexcept { return errorMessage; }
     inline void setError(const string& err) noexcept { errorMessage = err; }
 
     inline constexpr u64 IO_CHUNK_SIZE = 1048576;
 
+    //Names stdin or stdout in place of a file path
+    inline const path STDIO_PATH = "-";
+
+    //Raw bytes go through the standard streams, so Windows must not translate line endings
+    inline void setBinaryStdio() noexcept {
+        #if _LZIP_WINDOWS
+            _setmode(_fileno(stdin), _O_BINARY);
+            _setmode(_fileno(stdout), _O_BINARY);
+        #endif
+    }
+
+    //Regular files are mapped and handed out as views, pipes and anything that can't be mapped go through `stream`
     struct FileReader {
         ifstream file;
+        //Points at `file`, or at `cin` for `STDIO_PATH`
+        std::istream* stream{nullptr};
+        //The whole file when it's mapped, `position` is then the read offset
+        const u8* mapped{nullptr};
+        u64 position{0};
         size_t fileSize{0};
+        //Pipes can't seek and don't know their size up front
+        bool seekable{false};
 
         [[nodiscard]] explicit FileReader(const path& filePath) noexcept {
+            if (filePath == STDIO_PATH) {
+                setBinaryStdio();
+                stream = &cin;
+                return;
+            }
+            if (map(filePath)) {
+                seekable = true;
+                return;
+            }
             file.open(filePath, std::ios::binary);
             if (!file.is_open()) return;
+            stream = &file;
+            seekable = true;
             file.seekg(0, std::ios::end);
             fileSize = static_cast<size_t>(file.tellg());
             file.seekg(0, std::ios::beg);
         }
 
+        FileReader(const FileReader&) = delete;
+        FileReader& operator=(const FileReader&) = delete;
+
+        ~FileReader() noexcept {
+            if (mapped == nullptr) return;
+            #if _LZIP_WINDOWS
+                UnmapViewOfFile(mapped);
+            #else
+                munmap(const_cast<u8*>(mapped), fileSize);
+            #endif
+        }
+
+        //Empty and non-regular files are left to the stream
+        [[nodiscard]] bool map(const path& filePath) noexcept {
+            #if _LZIP_WINDOWS
+                const HANDLE handle = CreateFileW(filePath.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+                if (handle == INVALID_HANDLE_VALUE) return false;
+                LARGE_INTEGER size{};
+                HANDLE mapping = nullptr;
+                if (GetFileType(handle) == FILE_TYPE_DISK && GetFileSizeEx(handle, &size) && size.QuadPart > 0) mapping = CreateFileMappingW(handle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+                //The view keeps the mapping and the file alive on its own
+                if (mapping != nullptr) {
+                    mapped = static_cast<const u8*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+                    CloseHandle(mapping);
+                }
+                CloseHandle(handle);
+                if (mapped == nullptr) return false;
+                fileSize = static_cast<size_t>(size.QuadPart);
+            #else
+                const int fd = open(filePath.c_str(), O_RDONLY);
+                if (fd < 0) return false;
+                struct stat info{};
+                if (fstat(fd, &info) != 0 || !S_ISREG(info.st_mode) || info.st_size == 0) {
+                    close(fd);
+                    return false;
+                }
+                void* address = mmap(nullptr, static_cast<size_t>(info.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+                close(fd);
+                if (address == MAP_FAILED) return false;
+                madvise(address, static_cast<size_t>(info.st_size), MADV_SEQUENTIAL);
+                mapped = static_cast<const u8*>(address);
+                fileSize = static_cast<size_t>(info.st_size);
+            #endif
+            return true;
+        }
+
+        [[nodiscard]] bool isOpen() const noexcept { return stream != nullptr || mapped != nullptr; }
+
+        //Appends up to `size` bytes, fewer only at the end of the input
         [[nodiscard]] u64 nextChunk(vector<u8>& result, u64 size) noexcept {
-            if (!file.is_open()) return 0;
-            const size_t toRead = static_cast<size_t>(min<u64>(size, fileSize - static_cast<size_t>(file.tellg())));
+            if (mapped != nullptr) {
+                const span<const u8> view = nextView(result, size);
+                result.insert(result.end(), view.begin(), view.end());
+                return view.size();
+            }
+            if (stream == nullptr) return 0;
+            const size_t toRead = seekable ? static_cast<size_t>(min<u64>(size, fileSize - static_cast<size_t>(file.tellg()))) : static_cast<size_t>(size);
             if (toRead == 0) return 0;
-            vector<u8> buffer(toRead);
-            file.read(reinterpret_cast<char*>(buffer.data()), toRead);
-            result.insert(result.end(), buffer.begin(), buffer.end());
-            return toRead;
+            const size_t oldSize = result.size();
+            result.resize(oldSize + toRead);
+            stream->read(reinterpret_cast<char*>(result.data() + oldSize), static_cast<std::streamsize>(toRead));
+            const size_t readBytes = static_cast<size_t>(stream->gcount());
+            result.resize(oldSize + readBytes);
+            return readBytes;
         }
 
-        void reset() noexcept {
-            if (!file.is_open()) return;
-            file.seekg(0, std::ios::beg);
+        //Appends what a single read of stdin returns, which is at least a byte unless the input has ended; other inputs fill `size` like `nextChunk`
+        //stdin is read through the OS rather than `cin`, so nothing may have been read from it through `cin` before
+        [[nodiscard]] u64 nextAvailable(vector<u8>& result, u64 size) noexcept {
+            if (stream != &cin) return nextChunk(result, size);
+            const size_t oldSize = result.size();
+            result.resize(oldSize + size);
+            #if _LZIP_WINDOWS
+                DWORD readBytes = 0;
+                //A closed pipe fails instead of returning 0
+                if (!ReadFile(GetStdHandle(STD_INPUT_HANDLE), result.data() + oldSize, static_cast<DWORD>(min<u64>(size, 0x40000000u)), &readBytes, nullptr)) readBytes = 0;
+            #else
+                ssize_t readBytes;
+                do readBytes = ::read(STDIN_FILENO, result.data() + oldSize, size);
+                while (readBytes < 0 && errno == EINTR);
+                if (readBytes < 0) readBytes = 0;
+            #endif
+            result.resize(oldSize + static_cast<size_t>(readBytes));
+            return static_cast<u64>(readBytes);
+        }
+
+        //Whether `nextAvailable` would return within `timeoutMs`, either with data or at the end of the input; anything but stdin is always ready
+        [[nodiscard]] bool waitReadable(u32 timeoutMs) noexcept {
+            if (stream != &cin) return true;
+            #if _LZIP_WINDOWS
+                const HANDLE input = GetStdHandle(STD_INPUT_HANDLE);
+                //Only a pipe can tell how much is waiting in it
+                if (GetFileType(input) != FILE_TYPE_PIPE) return true;
+                const ULONGLONG deadline = GetTickCount64() + timeoutMs;
+                do {
+                    DWORD available = 0;
+                    if (!PeekNamedPipe(input, nullptr, 0, nullptr, &available, nullptr) || available > 0) return true;
+                    Sleep(1);
+                } while (GetTickCount64() < deadline);
+                return false;
+            #else
+                pollfd request{STDIN_FILENO, POLLIN, 0};
+                int ready;
+                do ready = poll(&request, 1, static_cast<int>(timeoutMs));
+                while (ready < 0 && errno == EINTR);
+                return ready != 0;
+            #endif
+        }
+
+        //Up to `size` bytes, straight from the mapping when there is one and read into `buffer` otherwise, valid until the next call with the same buffer
+        [[nodiscard]] span<const u8> nextView(vector<u8>& buffer, u64 size) noexcept {
+            if (mapped != nullptr) {
+                const u64 count = min<u64>(size, fileSize - position);
+                const span<const u8> view(mapped + position, static_cast<size_t>(count));
+                position += count;
+                return view;
+            }
+            buffer.clear();
+            buffer.resize(nextChunk(buffer, size));
+            return buffer;
+        }
+
+        [[nodiscard]] bool read(u8* data, u64 size) noexcept {
+            if (mapped != nullptr) {
+                if (size > fileSize - position) return false;
+                memcpy(data, mapped + position, static_cast<size_t>(size));
+                position += size;
+                return true;
+            }
+            if (stream == nullptr) return false;
+            stream->read(reinterpret_cast<char*>(data), static_cast<std::streamsize>(size));
+            return static_cast<u64>(stream->gcount()) == size;
+        }
+
+        void reset() noexcept { seek(0); }
+
+        void seek(u64 offset) noexcept {
+            if (mapped != nullptr) {
+                position = min<u64>(offset, fileSize);
+                return;
+            }
+            if (!seekable) return;
+            file.clear();
+            file.seekg(static_cast<std::streamoff>(offset), std::ios::beg);
         }
     };
 
+    //Unbuffered OS writes, small chunks are gathered until `IO_CHUNK_SIZE` so the file system sees few large writes
     struct FileWriter {
-        ofstream file;
+        #if _LZIP_WINDOWS
+            HANDLE handle{INVALID_HANDLE_VALUE};
+        #else
+            int fd{-1};
+        #endif
+        bool ownsHandle{false}, failed{false};
+        vector<u8> pending;
+        u64 writtenBytes{0};
 
         [[nodiscard]] explicit FileWriter(const path& filePath) noexcept {
-            file.open(filePath, std::ios::binary);
-            if (!file.is_open()) return;
+            if (filePath == STDIO_PATH) {
+                setBinaryStdio();
+                statusStream = &std::cerr;
+                #if _LZIP_WINDOWS
+                    handle = GetStdHandle(STD_OUTPUT_HANDLE);
+                #else
+                    fd = STDOUT_FILENO;
+                #endif
+                return;
+            }
+            #if _LZIP_WINDOWS
+                handle = CreateFileW(filePath.c_str(), GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+            #else
+                fd = open(filePath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+            #endif
+            ownsHandle = isOpen();
+        }
+
+        FileWriter(const FileWriter&) = delete;
+        FileWriter& operator=(const FileWriter&) = delete;
+
+        ~FileWriter() noexcept {
+            if (!isOpen()) return;
+            (void)flush();
+            if (!ownsHandle) return;
+            #if _LZIP_WINDOWS
+                CloseHandle(handle);
+            #else
+                close(fd);
+            #endif
+        }
+
+        [[nodiscard]] bool isOpen() const noexcept {
+            #if _LZIP_WINDOWS
+                return handle != INVALID_HANDLE_VALUE && handle != nullptr;
+            #else
+                return fd >= 0;
+            #endif
         }
 
         void writeChunk(span<const u8> data) noexcept {
-            if (!file.is_open()) return;
-            file.write(reinterpret_cast<const char*>(data.data()), data.size());
+            if (!isOpen()) return;
+            writtenBytes += data.size();
+            if (pending.size() + data.size() <= IO_CHUNK_SIZE) {
+                pending.insert(pending.end(), data.begin(), data.end());
+                return;
+            }
+            writeAll(pending);
+            pending.clear();
+            if (data.size() >= IO_CHUNK_SIZE) writeAll(data);
+            else pending.assign(data.begin(), data.end());
+        }
+
+        //Writes out whatever is gathered, false if any write so far has failed
+        [[nodiscard]] bool flush() noexcept {
+            writeAll(pending);
+            pending.clear();
+            return !failed;
+        }
+
+        void writeAll(span<const u8> data) noexcept {
+            while (!data.empty() && !failed) {
+                #if _LZIP_WINDOWS
+                    DWORD written = 0;
+                    if (!WriteFile(handle, data.data(), static_cast<DWORD>(min<u64>(data.size(), 0x40000000u)), &written, nullptr) || written == 0) failed = true;
+                #else
+                    const ssize_t written = write(fd, data.data(), data.size());
+                    if (written < 0 && errno == EINTR) continue;
+                    if (written <= 0) failed = true;
+                #endif
+                if (failed) return;
+                data = data.subspan(static_cast<u64>(written));
+            }
+        }
+
+        [[nodiscard]] u64 fileSize() const noexcept { return writtenBytes; }
+    };
+
+    //Writes at explicit offsets through the OS file API, so several threads can fill disjoint ranges at once
+    struct PositionalWriter {
+        #if _LZIP_WINDOWS
+            HANDLE handle{INVALID_HANDLE_VALUE};
+        #else
+            int fd{-1};
+        #endif
+        u8* mapped{nullptr};
+        u64 mappedSize{0};
+
+        [[nodiscard]] explicit PositionalWriter(const path& filePath) noexcept {
+            //Read access too, mapping for writing needs it
+            #if _LZIP_WINDOWS
+                handle = CreateFileW(filePath.c_str(), GENERIC_READ | GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+            #else
+                fd = open(filePath.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+            #endif
+        }
+
+        PositionalWriter(const PositionalWriter&) = delete;
+        PositionalWriter& operator=(const PositionalWriter&) = delete;
+
+        ~PositionalWriter() noexcept {
+            #if _LZIP_WINDOWS
+                if (mapped != nullptr) UnmapViewOfFile(mapped);
+                if (handle != INVALID_HANDLE_VALUE) CloseHandle(handle);
+            #else
+                if (mapped != nullptr) munmap(mapped, mappedSize);
+                if (fd >= 0) close(fd);
+            #endif
+        }
+
+        [[nodiscard]] bool isOpen() const noexcept {
+            #if _LZIP_WINDOWS
+                return handle != INVALID_HANDLE_VALUE;
+            #else
+                return fd >= 0;
+            #endif
+        }
+
+        //Sets the final size up front so the file system can allocate it in one go
+        [[nodiscard]] bool resize(u64 size) noexcept {
+            #if _LZIP_WINDOWS
+                LARGE_INTEGER position;
+                position.QuadPart = static_cast<LONGLONG>(size);
+                return SetFilePointerEx(handle, position, nullptr, FILE_BEGIN) && SetEndOfFile(handle);
+            #else
+                #if defined(__linux__)
+                    //Reserving the blocks turns a full disk into an error here instead of a fault while writing through the mapping
+                    if (size > 0) {
+                        const int error = posix_fallocate(fd, 0, static_cast<off_t>(size));
+                        if (error == 0) return true;
+                        if (error != EINVAL && error != EOPNOTSUPP) return false;
+                    }
+                #endif
+                return ftruncate(fd, static_cast<off_t>(size)) == 0;
+            #endif
+        }
+
+        //The whole file as writable memory after `resize(size)`, empty if it can't be mapped and `writeAt` has to be used
+        [[nodiscard]] span<u8> map(u64 size) noexcept {
+            if (size == 0) return {};
+            #if _LZIP_WINDOWS
+                const HANDLE mapping = CreateFileMappingW(handle, nullptr, PAGE_READWRITE, static_cast<DWORD>(size >> 32), static_cast<DWORD>(size), nullptr);
+                if (mapping == nullptr) return {};
+                mapped = static_cast<u8*>(MapViewOfFile(mapping, FILE_MAP_WRITE, 0, 0, 0));
+                CloseHandle(mapping);
+                if (mapped == nullptr) return {};
+            #else
+                void* address = mmap(nullptr, static_cast<size_t>(size), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+                if (address == MAP_FAILED) return {};
+                mapped = static_cast<u8*>(address);
+            #endif
+            mappedSize = size;
+            return {mapped, static_cast<size_t>(size)};
         }
 
-        [[nodiscard]] u64 fileSize() noexcept {
-            if (!file.is_open()) return 0;
-            const auto currentPos = file.tellp();
-            file.seekp(0, std::ios::end);
-            const auto size = file.tellp();
-            file.seekp(currentPos);
-            return static_cast<u64>(size);
+        [[nodiscard]] bool writeAt(u64 offset, span<const u8> data) noexcept {
+            while (!data.empty()) {
+                #if _LZIP_WINDOWS
+                    OVERLAPPED overlapped{};
+                    overlapped.Offset = static_cast<DWORD>(offset);
+                    overlapped.OffsetHigh = static_cast<DWORD>(offset >> 32);
+                    DWORD written = 0;
+                    if (!WriteFile(handle, data.data(), static_cast<DWORD>(min<u64>(data.size(), 0x40000000u)), &written, &overlapped) || written == 0) return false;
+                #else
+                    const ssize_t written = pwrite(fd, data.data(), data.size(), static_cast<off_t>(offset));
+                    if (written <= 0) return false;
+                #endif
+                offset += static_cast<u64>(written);
+                data = data.subspan(static_cast<u64>(written));
+            }
+            return true;
         }
     };
 
     inline bool normalize(path& p) noexcept {
+        if (p == STDIO_PATH) return true;
         error_code ec;
         p = absolute(p, ec);
         if (ec) return false;
@@ -108,6 +459,14 @@ namespace Lzip::Util {
         else [[unlikely]] result.insert(result.end(), arr.rbegin(), arr.rend());
     }
 
+    //Overwrites in place, for sizes only known once what follows them is written
+    template <typename T> requires is_integral_v<T>
+    inline void writeIntLE(u8* data, T value) noexcept {
+        const auto arr = bit_cast<array<u8, sizeof(value)>>(value);
+        if (endian::native == endian::little) [[likely]] memcpy(data, arr.data(), sizeof(T));
+        else [[unlikely]] for (size_t i = 0; i < sizeof(T); i++) data[i] = arr[sizeof(T) - 1 - i];
+    }
+
     template <typename T> requires is_integral_v<T>
     inline T readIntLE(const u8* data) noexcept {
         array<u8, sizeof(T)> arr{};
@@ -115,4 +474,22 @@ namespace Lzip::Util {
         else [[unlikely]] for (size_t i = 0; i < sizeof(T); i++) arr[sizeof(T) - 1 - i] = data[i];
         return bit_cast<T>(arr);
     }
+
+    //Bitstreams are MSB-first, compilers turn these into a single byte-swapping load/store
+    [[nodiscard]] inline u64 byteSwap64(u64 value) noexcept {
+        return ((value & 0xFFull) << 56) | ((value & 0xFF00ull) << 40) | ((value & 0xFF0000ull) << 24) | ((value & 0xFF000000ull) << 8) |
+            ((value >> 8) & 0xFF000000ull) | ((value >> 24) & 0xFF0000ull) | ((value >> 40) & 0xFF00ull) | (value >> 56);
+    }
+
+    [[nodiscard]] inline u64 loadBE64(const u8* data) noexcept {
+        u64 value;
+        memcpy(&value, data, sizeof(value));
+        if (endian::native == endian::little) [[likely]] value = byteSwap64(value);
+        return value;
+    }
+
+    inline void storeBE64(u8* data, u64 value) noexcept {
+        if (endian::native == endian::little) [[likely]] value = byteSwap64(value);
+        memcpy(data, &value, sizeof(value));
+    }
 }
\ No newline at end of file
@@ -0,0 +1,208 @@
+﻿#include <algorithm>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "lzip.hpp"
+#include "meta.hpp"
+#include "utils.hpp"
+
+//Checks the library API against the cases most likely to break quietly, exits with 1 if any failed
+//  lzip_test: runs every case and prints the ones that failed
+namespace Lzip::Test {
+    typedef uint8_t u8;
+    typedef uint32_t u32;
+    typedef uint64_t u64;
+    using std::cerr, std::string, std::vector, std::span;
+    namespace fs = std::filesystem;
+
+    constexpr u64 BLOCK_SIZE = Container::MIN_BLOCK_SIZE;
+    //Two whole blocks and a short one, so streams have every kind of block boundary
+    constexpr u64 INPUT_SIZE = BLOCK_SIZE * 2 + 12345;
+
+    u32 failures = 0;
+
+    void expect(bool condition, const string& what) {
+        if (condition) return;
+        cerr << "失败：" << what << "\n";
+        failures++;
+    }
+
+    //Random bytes no coder shrinks, so every block is stored and its payload sits right after its header
+    [[nodiscard]] vector<u8> noise(u64 size) {
+        std::mt19937_64 random(1);
+        vector<u8> result(size);
+        for (u8& byte : result) byte = static_cast<u8>(random());
+        return result;
+    }
+
+    //Words with skewed frequencies, which the Huffman and LZ77 coders both have something to do with
+    [[nodiscard]] vector<u8> text(u64 size) {
+        static constexpr const char* WORDS[] = {"the ", "lzip ", "block ", "of ", "stream ", "and ", "huffman ", "code ", "\n", "{\"id\": ", "42, "};
+        std::mt19937_64 random(2);
+        std::geometric_distribution<u32> pick(0.3);
+        vector<u8> result;
+        result.reserve(size + 16);
+        while (result.size() < size) {
+            const string word = WORDS[std::min<u32>(pick(random), std::size(WORDS) - 1)];
+            result.insert(result.end(), word.begin(), word.end());
+        }
+        result.resize(size);
+        return result;
+    }
+
+    [[nodiscard]] vector<CompressOptions> optionSets() {
+        vector<CompressOptions> result(5);
+        for (CompressOptions& options : result) options.blockSize = BLOCK_SIZE;
+        result[1].level = 0;
+        result[2].interleaved = true;
+        result[3].contextModel = true;
+        result[4].preset = builtinPreset("text");
+        return result;
+    }
+
+    void oneShot(const vector<u8>& input, const string& name) {
+        for (const CompressOptions& options : optionSets()) {
+            const string what = name + "（level " + std::to_string(options.level) + "，preset " + std::to_string(options.preset) + "）";
+            Encoder encoder(options);
+            Decoder decoder;
+            vector<u8> stream, output;
+            encoder.compress(input, stream);
+            const Status status = decoder.decompress(stream, output);
+            expect(status == Status::Ok && output == input, "一次性往返 " + what + "：" + statusMessage(status));
+
+            //The span overloads, with buffers sized from `compressBound` and the footer
+            vector<u8> bounded(Encoder::compressBound(input.size(), options.blockSize));
+            u64 written = 0, size = 0;
+            expect(encoder.compress(input, bounded, written) == Status::Ok && std::equal(stream.begin(), stream.end(), bounded.begin(), bounded.begin() + static_cast<std::ptrdiff_t>(written)) && written == stream.size(), "写入缓冲区的压缩 " + what);
+            expect(Decoder::originalSize(stream, size) == Status::Ok && size == input.size(), "从尾部读出原始大小 " + what);
+            vector<u8> exact(size);
+            expect(decoder.decompress(stream, exact, written) == Status::Ok && written == input.size() && exact == input, "写入缓冲区的解压 " + what);
+        }
+    }
+
+    void streaming(const vector<u8>& input, const string& name) {
+        for (const CompressOptions& options : optionSets()) {
+            const string what = name + "（level " + std::to_string(options.level) + "，preset " + std::to_string(options.preset) + "）";
+            Encoder encoder(options);
+            Decoder decoder;
+            vector<u8> stream, output;
+            //Uneven pieces with a flush now and then; after each flush the decoder has to have everything passed in so far
+            std::mt19937_64 random(3);
+            u64 consumed = 0, fed = 0;
+            bool complete = true;
+            for (u32 step = 0; consumed < input.size(); step++) {
+                const u64 count = std::min<u64>(input.size() - consumed, random() % (BLOCK_SIZE / 2) + 1);
+                encoder.update(span(input).subspan(consumed, count), stream);
+                consumed += count;
+                if (step % 3 != 2) continue;
+                encoder.flush(stream);
+                complete &= decoder.update(span(stream).subspan(fed), output) == Status::Ok && output.size() == consumed;
+                fed = stream.size();
+            }
+            encoder.finish(stream);
+            expect(complete, "flush 之后解码出已输入的全部数据 " + what);
+            //The rest goes in a byte at a time at first, so headers and tables arrive split
+            Status status = Status::Ok;
+            for (u32 i = 0; i < 64 && fed < stream.size() && status == Status::Ok; i++) status = decoder.update(span(stream).subspan(fed++, 1), output);
+            if (status == Status::Ok) status = decoder.update(span(stream).subspan(fed), output);
+            if (status == Status::Ok) status = decoder.finish();
+            expect(status == Status::Ok && output == input, "update/flush/finish 往返 " + what + "：" + statusMessage(status));
+        }
+    }
+
+    void outputTooSmall() {
+        const vector<u8> input = noise(INPUT_SIZE);
+        CompressOptions options;
+        options.blockSize = BLOCK_SIZE;
+        Encoder encoder(options);
+        Decoder decoder;
+        const u64 bound = Encoder::compressBound(input.size(), BLOCK_SIZE);
+        vector<u8> stream(bound);
+        u64 written = 0;
+        //Stored blocks make the bound exact, one byte short of it can't hold the stream
+        expect(encoder.compress(input, stream, written) == Status::Ok && written == bound, "无法压缩的数据正好用满 compressBound");
+        vector<u8> small(bound - 1);
+        expect(encoder.compress(input, small, written) == Status::OutputTooSmall, "compressBound 减一的缓冲区报告 OutputTooSmall");
+        vector<u8> output(input.size() - 1);
+        expect(decoder.decompress(stream, output, written) == Status::OutputTooSmall, "比原始大小少一字节的缓冲区报告 OutputTooSmall");
+    }
+
+    void checksumMismatch() {
+        const vector<u8> input = noise(INPUT_SIZE);
+        CompressOptions options;
+        options.blockSize = BLOCK_SIZE;
+        Encoder encoder(options);
+        vector<u8> stream, output;
+        encoder.compress(input, stream);
+        //A stored payload decodes whatever its bytes are, only the CRC can notice
+        stream[Container::FILE_HEADER_SIZE + Container::BLOCK_HEADER_SIZE + 1000] ^= 0x10;
+        Decoder decoder;
+        Status status = decoder.decompress(stream, output);
+        expect(status == Status::ChecksumMismatch, string("翻转一个负载字节后一次性解压报告 ChecksumMismatch：") + statusMessage(status));
+        output.clear();
+        status = decoder.update(stream, output);
+        if (status == Status::Ok) status = decoder.finish();
+        expect(status == Status::ChecksumMismatch, string("翻转一个负载字节后流式解压报告 ChecksumMismatch：") + statusMessage(status));
+    }
+
+    //Version 1 files are written by hand: a table that gives 'a' and 'b' one bit each, so every byte of the bitstream is 8 symbols, most significant bit first
+    void legacyDecode() {
+        vector<u8> original, file(LZIP_MAGIC.begin(), LZIP_MAGIC.end());
+        std::mt19937_64 random(4);
+        for (u64 i = 0; i < 100003; i++) original.push_back(random() % 3 == 0 ? 'b' : 'a');
+        Util::writeIntLE<u32>(file, LZIP_LEGACY_VERSION);
+        Util::writeIntLE<u64>(file, original.size());
+        vector<u8> codeLens(256);
+        codeLens['a'] = codeLens['b'] = 1;
+        file.insert(file.end(), codeLens.begin(), codeLens.end());
+        for (u64 i = 0; i < original.size(); i += 8) {
+            u8 byte = 0;
+            for (u64 j = 0; j < 8; j++) byte = static_cast<u8>(byte << 1 | (i + j < original.size() && original[i + j] == 'b'));
+            file.push_back(byte);
+        }
+
+        const fs::path directory = fs::temp_directory_path() / ("lzip_test_" + std::to_string(std::random_device()()));
+        fs::create_directories(directory);
+        const fs::path compressed = directory / "legacy.lzip", decompressed = directory / "legacy";
+        std::ofstream(compressed, std::ios::binary).write(reinterpret_cast<const char*>(file.data()), static_cast<std::streamsize>(file.size()));
+        DecompressOptions options;
+        options.threads = 1;
+        const bool decoded = decompressFile(compressed.string(), "", options);
+        std::ifstream stream(decompressed, std::ios::binary);
+        const vector<u8> output{std::istreambuf_iterator<char>(stream), std::istreambuf_iterator<char>()};
+        expect(decoded && output == original, "解压版本 1 文件：" + lastError());
+        stream.close();
+
+        //The buffer API leaves version 1 to the file functions
+        vector<u8> unused;
+        Decoder decoder;
+        expect(decoder.decompress(file, unused) == Status::UnsupportedVersion, "Decoder 对版本 1 数据流报告 UnsupportedVersion");
+        std::error_code error;
+        fs::remove_all(directory, error);
+    }
+}
+
+int main() {
+    using namespace Lzip::Test;
+    const vector<u8> noiseInput = noise(INPUT_SIZE), textInput = text(INPUT_SIZE);
+    oneShot(textInput, "文本");
+    oneShot(noiseInput, "随机数据");
+    oneShot({}, "空输入");
+    streaming(textInput, "文本");
+    streaming(noiseInput, "随机数据");
+    outputTooSmall();
+    checksumMismatch();
+    legacyDecode();
+    if (failures != 0) {
+        cerr << failures << " 项检查失败。\n";
+        return 1;
+    }
+    std::cout << "全部检查通过。\n";
+    return 0;
+}